@@ -0,0 +1,403 @@
+#ifndef darknet_activation_planner_h_INCLUDED
+#define darknet_activation_planner_h_INCLUDED
+
+#include "layers.h"
+
+#include <algorithm>
+#include <array>
+#include <dlib/dnn.h>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+namespace darknet
+{
+    using namespace dlib;
+
+    namespace detail
+    {
+        template <typename T, typename = void> struct has_output : std::false_type
+        {
+        };
+        template <typename T>
+        struct has_output<T, std::void_t<decltype(std::declval<const T&>().get_output())>>
+            : std::true_type
+        {
+        };
+
+        // The tensors a layer reads through tags of its subnetwork, besides the output of the
+        // subnetwork itself.  Layers that read tags must specialize it, or the planner would
+        // reuse the memory of the tagged tensors too early.
+        template <typename DETAILS> struct tagged_inputs
+        {
+            template <typename SUBNET> static void get(const SUBNET&, std::vector<const tensor*>&)
+            {
+            }
+        };
+
+        template <template <typename> class... TAGS> struct tagged_inputs<concat_<TAGS...>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                (inputs.push_back(&layer<TAGS>(sub).get_output()), ...);
+            }
+        };
+
+        template <template <typename> class TAG> struct tagged_inputs<add_prev_<TAG>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                inputs.push_back(&layer<TAG>(sub).get_output());
+            }
+        };
+
+        template <template <typename> class TAG> struct tagged_inputs<mult_prev_<TAG>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                inputs.push_back(&layer<TAG>(sub).get_output());
+            }
+        };
+
+        template <template <typename> class TAG>
+        struct tagged_inputs<resize_prev_to_tagged_<TAG>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                inputs.push_back(&layer<TAG>(sub).get_output());
+            }
+        };
+
+        template <template <typename> class... TAGS> struct tagged_inputs<route_<TAGS...>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                route_<TAGS...>::get_inputs(sub, inputs);
+            }
+        };
+
+        // a cascaded max pool reads the smaller pool below its skip layer
+        template <long size, long step> struct tagged_inputs<cascaded_max_pool_<size, step>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                if constexpr (size != step)
+                    inputs.push_back(&sub.subnet().get_output());
+            }
+        };
+
+        // a fused_con_ on top of a route_ reads the tensors of the route
+        template <
+            long nf,
+            long nr,
+            long nc,
+            int sy,
+            int sx,
+            int py,
+            int px,
+            fused_activation act>
+        struct tagged_inputs<fused_con_<nf, nr, nc, sy, sx, py, px, act>>
+        {
+            template <typename SUBNET>
+            static void get(const SUBNET& sub, std::vector<const tensor*>& inputs)
+            {
+                if constexpr (reads_route<SUBNET>::value)
+                    layer_details_of<SUBNET>::get_inputs(sub.subnet(), inputs);
+            }
+        };
+    }  // namespace detail
+
+    // The memory counters of an activation_planner, which do not depend on the network type.
+    class activation_planner_base
+    {
+        public:
+        // activation memory of the network run normally, in bytes
+        size_t get_default_bytes() const { return default_bytes; }
+
+        // activation memory with the planner: the arenas and the tensors that are not managed,
+        // like the kept outputs and the copy of the input
+        size_t get_planned_bytes() const
+        {
+            size_t bytes = unmanaged_bytes;
+            for (const auto& a : arenas)
+                bytes += a.capacity * sizeof(float);
+            return bytes;
+        }
+
+        size_t get_num_arenas() const { return arenas.size(); }
+
+        void print_summary(std::ostream& out) const
+        {
+            const auto flags = out.flags();
+            out << std::fixed << std::setprecision(1) << "activations: "
+                << get_default_bytes() / 1048576. << " MiB without planning, "
+                << get_planned_bytes() / 1048576. << " MiB planned (" << get_num_arenas()
+                << " arenas for " << num_managed << " layer outputs)\n";
+            out.flags(flags);
+        }
+
+        protected:
+        struct arena
+        {
+            resizable_tensor memory;
+            size_t capacity = 0;
+            bool busy = false;
+        };
+
+        std::vector<arena> arenas;
+        size_t default_bytes = 0;
+        size_t unmanaged_bytes = 0;
+        size_t num_managed = 0;
+    };
+
+    // Runs an inference network one layer at a time and reuses the memory of the activations.
+    // A dlib network keeps the output of every layer alive after the forward pass, although
+    // most of them are never read again.  The planner finds the last layer that reads each
+    // output, either as its input or through a tag, and moves the memory of the outputs that
+    // are dead back to a few arenas, from which the next outputs are assigned with a best fit
+    // on their size.  Layers that dlib runs in place keep sharing the tensor of their input.
+    //
+    // The first pass, and the first one after the input size changed, runs the network normally
+    // to record the tensor of every layer and their sizes, which is also the activation memory
+    // without planning.  Only the final output and the tensors given to the constructor, e.g.
+    // the outputs of the yolo tags, are readable after a pass.  The planner refers to the
+    // network, which must not be moved or copied while it is in use.
+    template <typename net_type> class activation_planner : public activation_planner_base
+    {
+        public:
+        explicit activation_planner(net_type& net, std::vector<const tensor*> keep = {})
+            : net(net), keep(keep.begin(), keep.end())
+        {
+        }
+
+        net_type& get_net() const { return net; }
+
+        const tensor& forward(const tensor& x)
+        {
+            const std::array<long long, 4> shape{x.num_samples(), x.k(), x.nr(), x.nc()};
+            if (steps.empty() or shape != planned_shape)
+            {
+                clear();
+                net.forward(x);
+                planned_shape = shape;
+                plan();
+                return net.get_output();
+            }
+            for (size_t i = 0; i < steps.size(); ++i)
+            {
+                auto& s = steps[i];
+                if (s.managed)
+                    acquire(i);
+                s.run(x);
+                if (s.managed)
+                {
+                    sizes[i] = s.output->size();
+                    auto& arena = arenas[arena_of[i]];
+                    arena.capacity = std::max(arena.capacity, sizes[i]);
+                }
+                for (const size_t j : releases[i])
+                    release(j);
+            }
+            return net.get_output();
+        }
+
+        private:
+        void clear()
+        {
+            steps.clear();
+            arenas.clear();
+            default_bytes = unmanaged_bytes = num_managed = 0;
+        }
+
+        struct step
+        {
+            std::function<void(const tensor&)> run;
+            resizable_tensor* output = nullptr;
+            std::vector<const tensor*> inputs;
+            bool managed = false;  // the step writes to its own tensor, taken from an arena
+        };
+
+        static resizable_tensor* as_resizable(const tensor& t)
+        {
+            return &dynamic_cast<resizable_tensor&>(const_cast<tensor&>(t));
+        }
+
+        // The layers are collected from the input to the output, so the steps are in the order
+        // of the forward pass.  input is the tensor given to the bottom of the network, which
+        // is the argument of forward() for the whole network and the previous block for the
+        // networks repeated by a repeat layer.
+        template <typename DETAILS, typename SUBNET, typename E>
+        void collect(add_layer<DETAILS, SUBNET, E>& l, const tensor* input)
+        {
+            auto& sub = l.subnet();
+            if constexpr (not detail::has_output<std::decay_t<decltype(sub)>>::value)
+            {
+                add_bottom(l, input);
+            }
+            else
+            {
+                collect(sub, input);
+                step s;
+                s.output = as_resizable(l.get_output());
+                s.inputs.push_back(&sub.get_output());
+                detail::tagged_inputs<DETAILS>::get(sub, s.inputs);
+                // dlib runs a layer in place when its output is the one of its subnetwork
+                s.managed = s.output != &sub.get_output() and keep.count(s.output) == 0;
+                auto* output = s.output;
+                s.run = [&l, &sub, output](const tensor&)
+                { impl::call_layer_forward(l.layer_details(), sub, *output); };
+                steps.push_back(std::move(s));
+            }
+        }
+
+        template <unsigned long ID, typename SUBNET, typename E>
+        void collect(add_tag_layer<ID, SUBNET, E>& l, const tensor* input)
+        {
+            if constexpr (not detail::has_output<std::decay_t<decltype(l.subnet())>>::value)
+                add_bottom(l, input);
+            else
+                collect(l.subnet(), input);
+        }
+
+        template <template <typename> class TAG, typename SUBNET>
+        void collect(add_skip_layer<TAG, SUBNET>& l, const tensor* input)
+        {
+            collect(l.subnet(), input);
+        }
+
+        template <size_t num, template <typename> class REPEATED, typename SUBNET>
+        void collect(repeat<num, REPEATED, SUBNET>& l, const tensor* input)
+        {
+            collect(l.subnet(), input);
+            const tensor* previous = &l.subnet().get_output();
+            for (long i = static_cast<long>(l.num_repetitions()) - 1; i >= 0; --i)
+            {
+                auto& block = l.get_repeated_layer(i);
+                collect(block, previous);
+                previous = &block.get_output();
+            }
+        }
+
+        // the layer on the input layer, which runs its own forward
+        template <typename layer_type> void add_bottom(layer_type& l, const tensor* input)
+        {
+            step s;
+            s.output = as_resizable(l.get_output());
+            if (input)
+                s.inputs.push_back(input);
+            s.run = [&l, input](const tensor& x) { l.forward(input ? *input : x); };
+            steps.push_back(std::move(s));
+        }
+
+        void plan()
+        {
+            collect(net, nullptr);
+            keep.insert(&net.get_output());
+            for (auto& s : steps)
+                s.managed = s.managed and keep.count(s.output) == 0;
+
+            // the last step reading each tensor, an in-place step counts as a reader
+            std::map<const tensor*, size_t> last_use;
+            for (size_t i = 0; i < steps.size(); ++i)
+            {
+                for (const auto* t : steps[i].inputs)
+                    last_use[t] = i;
+            }
+            std::map<const tensor*, size_t> producer;
+            std::set<const tensor*> all_tensors;
+            sizes.assign(steps.size(), 0);
+            arena_of.assign(steps.size(), 0);
+            releases.assign(steps.size(), {});
+            for (size_t i = 0; i < steps.size(); ++i)
+            {
+                const auto& s = steps[i];
+                all_tensors.insert(s.output);
+                if (not s.managed)
+                    continue;
+                ++num_managed;
+                sizes[i] = s.output->size();
+                producer[s.output] = i;
+                // an output that nothing reads is released right away
+                const auto use = last_use.find(s.output);
+                releases[use == last_use.end() ? i : use->second].push_back(i);
+            }
+            for (const auto* t : all_tensors)
+            {
+                default_bytes += t->size() * sizeof(float);
+                if (producer.count(t) == 0)
+                    unmanaged_bytes += t->size() * sizeof(float);
+            }
+
+            // size the arenas with the outputs of the first pass, which frees them
+            for (size_t i = 0; i < steps.size(); ++i)
+            {
+                if (steps[i].managed)
+                    acquire(i);
+                for (const size_t j : releases[i])
+                    release(j);
+            }
+        }
+
+        // Assigns the smallest free arena that fits the output of step i, or grows the largest
+        // free one, or creates a new arena.
+        void acquire(const size_t i)
+        {
+            long best = -1, largest = -1;
+            for (size_t a = 0; a < arenas.size(); ++a)
+            {
+                if (arenas[a].busy)
+                    continue;
+                const size_t capacity = arenas[a].capacity;
+                if (capacity >= sizes[i] and (best < 0 or capacity < arenas[best].capacity))
+                    best = a;
+                if (largest < 0 or capacity > arenas[largest].capacity)
+                    largest = a;
+            }
+            if (best < 0)
+                best = largest;
+            if (best < 0)
+            {
+                best = arenas.size();
+                arenas.emplace_back();
+            }
+            auto& a = arenas[best];
+            a.busy = true;
+            a.capacity = std::max(a.capacity, sizes[i]);
+            arena_of[i] = best;
+            auto& output = *steps[i].output;
+            output.clear();
+            output = std::move(a.memory);
+            a.memory.clear();
+        }
+
+        void release(const size_t i)
+        {
+            auto& a = arenas[arena_of[i]];
+            auto& output = *steps[i].output;
+            a.memory.clear();
+            a.memory = std::move(output);
+            output.clear();
+            a.busy = false;
+        }
+
+        net_type& net;
+        std::set<const tensor*> keep;
+        std::array<long long, 4> planned_shape{};
+        std::vector<step> steps;
+        std::vector<size_t> sizes;
+        std::vector<size_t> arena_of;
+        std::vector<std::vector<size_t>> releases;
+    };
+}  // namespace darknet
+
+#endif  // darknet_activation_planner_h_INCLUDED
@@ -0,0 +1,725 @@
+#include "darknet.h"
+#include "models.h"
+#include "yolo_utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <dlib/cmd_line_parser.h>
+#include <dlib/dir_nav.h>
+#include <dlib/image_io.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+const static std::string exts{".jpg .JPG .jpeg .JPEG .png .PNG .gif .GIF"};
+
+// The scalar decoding loop that add_detections replaced, kept as the benchmark baseline.
+void add_detections_loop(
+    const dlib::tensor& t,
+    const long sample,
+    const std::vector<std::pair<float, float>>& anchors,
+    const int stride,
+    const float conf_thresh,
+    std::vector<detection>& detections,
+    bool new_coords = false,
+    const box_transform& tform = box_transform())
+{
+    const size_t nattr = t.k() / anchors.size();
+    const size_t nclasses = nattr - 5;
+    const float* const out = t.host();
+    for (size_t a = 0; a < anchors.size(); ++a)
+    {
+        for (long y = 0; y < t.nr(); ++y)
+        {
+            for (long x = 0; x < t.nc(); ++x)
+            {
+                if (new_coords)
+                {
+                    const float obj = out[dlib::tensor_index(t, sample, a * nattr + 4, y, x)];
+                    // clang-format off
+                    if (obj > conf_thresh)
+                    {
+                        detection d;
+                        d.obj = obj;
+                        d.x = (out[dlib::tensor_index(t, sample, a * nattr + 0, y, x)] + x) / t.nc();
+                        d.y = (out[dlib::tensor_index(t, sample, a * nattr + 1, y, x)] + y) / t.nr();
+                        d.w = out[dlib::tensor_index(t, sample, a * nattr + 2, y, x)] *
+                              out[dlib::tensor_index(t, sample, a * nattr + 2, y, x)] * 4 * anchors[a].first / (t.nc() * stride);
+                        d.h = out[dlib::tensor_index(t, sample, a * nattr + 3, y, x)] *
+                              out[dlib::tensor_index(t, sample, a * nattr + 3, y, x)] * 4 * anchors[a].second / (t.nr() * stride);
+                        for (size_t p = 0; p < nclasses; ++p)
+                        {
+                            const float temp = out[dlib::tensor_index(t, sample, a * nattr + 5 + p, y, x)];
+                            if (temp > d.score)
+                            {
+                                d.score = temp;
+                                d.id = p;
+                            }
+                        }
+                        d.score *= d.obj;
+                        d.x = (d.x - tform.x_offset) * tform.x_scale;
+                        d.y = (d.y - tform.y_offset) * tform.y_scale;
+                        d.w *= tform.x_scale;
+                        d.h *= tform.y_scale;
+                        detections.push_back(std::move(d));
+                    }
+                }
+                else
+                {
+                    const float obj = sigmoid(out[dlib::tensor_index(t, sample, a * nattr + 4, y, x)]);
+                    if (obj > conf_thresh)
+                    {
+                        detection d;
+                        d.obj = obj;
+                        d.x = (sigmoid(out[dlib::tensor_index(t, sample, a * nattr + 0, y, x)]) + x) / t.nc();
+                        d.y = (sigmoid(out[dlib::tensor_index(t, sample, a * nattr + 1, y, x)]) + y) / t.nr();
+                        d.w = std::exp(out[dlib::tensor_index(t, sample, a * nattr + 2, y, x)]) * anchors[a].first / (t.nc() * stride);
+                        d.h = std::exp(out[dlib::tensor_index(t, sample, a * nattr + 3, y, x)]) * anchors[a].second / (t.nr() * stride);
+                        for (size_t p = 0; p < nclasses; ++p)
+                        {
+                            const float temp = sigmoid(out[dlib::tensor_index(t, sample, a * nattr + 5 + p, y, x)]);
+                            if (temp > d.score)
+                            {
+                                d.score = temp;
+                                d.id = p;
+                            }
+                        }
+                        d.score *= d.obj;
+                        d.x = (d.x - tform.x_offset) * tform.x_scale;
+                        d.y = (d.y - tform.y_offset) * tform.y_scale;
+                        d.w *= tform.x_scale;
+                        d.h *= tform.y_scale;
+                        detections.push_back(std::move(d));
+                    }
+                }
+                // clang-format on
+            }
+        }
+    }
+}
+
+
+// The all-pairs suppression loop that nms replaced, kept as the benchmark baseline.
+void nms_all_pairs(float conf_thresh, float nms_thresh, std::vector<detection>& detections)
+{
+    // conf thresh on score
+    detections.erase(
+        std::remove_if(
+            detections.begin(),
+            detections.end(),
+            [conf_thresh](const detection& d) { return d.score < conf_thresh; }),
+        detections.end());
+
+    // sort conf
+    std::sort(
+        detections.begin(),
+        detections.end(),
+        [](const detection& a, const detection& b) -> bool { return a.score > b.score; });
+
+    // nms
+    for (size_t d = 0; d < detections.size(); d++)
+    {
+        if (detections[d].is_empty())
+            continue;
+
+        for (size_t dj = 0; dj < detections.size(); dj++)
+        {
+            if (d == dj || detections[dj].is_empty())
+                continue;
+
+            float _iou = iou(detections[d], detections[dj], IOU);
+
+            if (_iou > nms_thresh)
+                detections[dj].set_empty();
+        }
+    }
+
+    detections.erase(
+        std::remove_if(
+            detections.begin(),
+            detections.end(),
+            [](const detection& d) { return d.is_empty(); }),
+        detections.end());
+}
+
+// Throws unless the decoder found the same candidates as the scalar loop, in the same order,
+// with the same class ids and with boxes and scores within a relative tolerance: the decoder
+// compares the logits against the logit of the threshold and its sigmoid may round differently.
+void check_decoded(const std::vector<detection>& expected, const std::vector<detection>& actual)
+{
+    if (actual.size() != expected.size())
+    {
+        throw std::runtime_error(
+            "the decoder found " + std::to_string(actual.size()) + " candidates instead of " +
+            std::to_string(expected.size()));
+    }
+    const auto close = [](const float a, const float b)
+    { return std::abs(a - b) <= 1e-5f * std::max(1.f, std::abs(b)); };
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        const auto& e = expected[i];
+        const auto& a = actual[i];
+        if (a.id != e.id or not close(a.x, e.x) or not close(a.y, e.y) or
+            not close(a.w, e.w) or not close(a.h, e.h) or not close(a.obj, e.obj) or
+            not close(a.score, e.score))
+        {
+            std::ostringstream sout;
+            sout << "the decoder differs from the loop at candidate " << i << ": id " << a.id
+                 << " (" << e.id << "), x " << a.x << " (" << e.x << "), y " << a.y << " ("
+                 << e.y << "), w " << a.w << " (" << e.w << "), h " << a.h << " (" << e.h
+                 << "), score " << a.score << " (" << e.score << ")";
+            throw std::runtime_error(sout.str());
+        }
+    }
+}
+
+template <typename F> double time_us(const long iterations, F&& f)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i)
+        f();
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+}
+
+void bench_decode(
+    const input_size img_size,
+    const long num_classes,
+    const float conf_thresh,
+    const bool new_coords,
+    const long iterations)
+{
+    const std::vector<std::pair<float, float>> anchors = {{12, 16}, {19, 36}, {40, 28}};
+    const long nattr = num_classes + 5;
+    std::cout << "decode: img-size " << img_size.width << "x" << img_size.height << ", classes "
+              << num_classes
+              << ", new_coords " << new_coords << '\n';
+    double total_loop = 0, total_decoder = 0;
+    for (const int stride : {8, 16, 32})
+    {
+        dlib::resizable_tensor t(
+            1,
+            anchors.size() * nattr,
+            img_size.height / stride,
+            img_size.width / stride);
+        dlib::tt::tensor_rand rnd(0);
+        rnd.fill_gaussian(t, 0, 2);
+        // make the objectness sparse: about 2% of the cells are above the threshold
+        float* const out = t.host();
+        for (size_t a = 0; a < anchors.size(); ++a)
+        {
+            for (long i = 0; i < t.nr() * t.nc(); ++i)
+                out[(a * nattr + 4) * t.nr() * t.nc() + i] -= 5;
+        }
+        if (new_coords)
+        {
+            for (size_t i = 0; i < t.size(); ++i)
+                out[i] = sigmoid(out[i]);
+        }
+
+        std::vector<detection> expected, detections;
+        const double loop_us = time_us(iterations, [&] {
+            expected.clear();
+            add_detections_loop(t, 0, anchors, stride, conf_thresh, expected, new_coords);
+        });
+        const double decoder_us = time_us(iterations, [&] {
+            detections.clear();
+            add_detections(t, 0, anchors, stride, conf_thresh, detections, new_coords);
+        });
+        check_decoded(expected, detections);
+        total_loop += loop_us;
+        total_decoder += decoder_us;
+        std::cout << "  stride " << std::setw(2) << stride << " (" << t.nr() << "x" << t.nc()
+                  << ", " << detections.size() << " candidates): loop " << loop_us
+                  << " us, decoder " << decoder_us << " us, speedup " << loop_us / decoder_us
+                  << "x, same candidates\n";
+    }
+    std::cout << "  total: loop " << total_loop << " us, decoder " << total_decoder
+              << " us, speedup " << total_loop / total_decoder << "x\n";
+}
+
+void bench_nms(
+    const long num_candidates,
+    const long num_classes,
+    const float conf_thresh,
+    const float nms_thresh,
+    const long iterations)
+{
+    // clusters of overlapping boxes, as produced by the decoder around each object
+    dlib::rand rnd(0);
+    std::vector<detection> candidates(num_candidates);
+    for (auto& d : candidates)
+    {
+        const long cluster = rnd.get_integer(num_candidates / 20 + 1);
+        dlib::rand crnd(cluster);
+        d.x = crnd.get_random_float() + 0.02 * rnd.get_random_gaussian();
+        d.y = crnd.get_random_float() + 0.02 * rnd.get_random_gaussian();
+        d.w = 0.05 + 0.2 * crnd.get_random_float() + 0.01 * rnd.get_random_gaussian();
+        d.h = 0.05 + 0.2 * crnd.get_random_float() + 0.01 * rnd.get_random_gaussian();
+        d.id = rnd.get_integer(num_classes);
+        d.obj = rnd.get_random_float();
+        d.score = conf_thresh + (1 - conf_thresh) * rnd.get_random_float();
+    }
+
+    std::cout << "nms: " << num_candidates << " candidates, " << num_classes << " classes\n";
+    std::vector<detection> detections;
+    size_t num_kept = 0;
+    const double all_pairs_us = time_us(iterations, [&] {
+        detections = candidates;
+        nms_all_pairs(conf_thresh, nms_thresh, detections);
+        num_kept = detections.size();
+    });
+    std::cout << "  all pairs, across classes: " << all_pairs_us << " us, " << num_kept
+              << " kept\n";
+    nms_options options;
+    options.class_agnostic = true;
+    const double agnostic_us = time_us(iterations, [&] {
+        detections = candidates;
+        nms(conf_thresh, nms_thresh, detections, options);
+    });
+    std::cout << "  engine, across classes:    " << agnostic_us << " us, " << detections.size()
+              << " kept, speedup " << all_pairs_us / agnostic_us << "x\n";
+    options.class_agnostic = false;
+    const double per_class_us = time_us(iterations, [&] {
+        detections = candidates;
+        nms(conf_thresh, nms_thresh, detections, options);
+    });
+    std::cout << "  engine, per class:         " << per_class_us << " us, " << detections.size()
+              << " kept, speedup " << all_pairs_us / per_class_us << "x\n";
+    options.iou_type = DIOU;
+    const double diou_us = time_us(iterations, [&] {
+        detections = candidates;
+        nms(conf_thresh, nms_thresh, detections, options);
+    });
+    std::cout << "  engine, per class, DIoU:   " << diou_us << " us, " << detections.size()
+              << " kept\n";
+}
+
+// Compares the vectorized Mish of fast_mish_ against the scalar one with the exp of the standard
+// library and against dlib's, on the output of a convolution of the given size with 64 filters,
+// and measures their largest error against Mish in double precision over [-20, 20].
+void bench_mish(const input_size img_size, const long iterations)
+{
+    const auto reference = [](const double x) { return x * std::tanh(std::log1p(std::exp(x))); };
+    const long num_points = 1 << 20;
+    dlib::resizable_tensor x(1, 1, 1, num_points), y;
+    y.copy_size(x);
+    float* const in = x.host();
+    for (long i = 0; i < num_points; ++i)
+        in[i] = -20 + 40.f * i / (num_points - 1);
+    const auto max_errors = [&](const float* out)
+    {
+        double max_abs = 0, max_rel = 0;
+        for (long i = 0; i < num_points; ++i)
+        {
+            const double ref = reference(in[i]);
+            const double err = std::abs(out[i] - ref);
+            max_abs = std::max(max_abs, err);
+            if (ref != 0)
+                max_rel = std::max(max_rel, err / std::abs(ref));
+        }
+        std::ostringstream sout;
+        sout << std::scientific << std::setprecision(2) << "max abs error " << max_abs
+             << ", max rel error " << max_rel;
+        return sout.str();
+    };
+
+    std::cout << "mish: kernel " << darknet::mish_kernel_name() << '\n';
+    float* const out = y.host();
+    for (long i = 0; i < num_points; ++i)
+        out[i] = darknet::mish_exact(in[i]);
+    std::cout << "  exact:  " << max_errors(out) << '\n';
+    darknet::apply_mish(in, out, num_points);
+    std::cout << "  kernel: " << max_errors(out) << '\n';
+    dlib::tt::mish(y, x);
+    std::cout << "  dlib:   " << max_errors(y.host()) << '\n';
+
+    const long nr = img_size.height / 4;
+    const long nc = img_size.width / 4;
+    x.set_size(1, 64, nr, nc);
+    y.copy_size(x);
+    dlib::tt::tensor_rand rnd(0);
+    rnd.fill_gaussian(x, 0, 3);
+    const double exact_us = time_us(iterations, [&] {
+        const float* const src = x.host();
+        float* const dst = y.host();
+        for (size_t i = 0; i < x.size(); ++i)
+            dst[i] = darknet::mish_exact(src[i]);
+    });
+    const double kernel_us =
+        time_us(iterations, [&] { darknet::apply_mish(x.host(), y.host(), x.size()); });
+    const double dlib_us = time_us(iterations, [&] { dlib::tt::mish(y, x); });
+    std::cout << "  64x" << nr << "x" << nc << ": exact " << exact_us << " us, dlib "
+              << dlib_us << " us, kernel " << kernel_us << " us, speedup "
+              << exact_us / kernel_us << "x (" << dlib_us / kernel_us << "x over dlib)\n";
+}
+
+// the spp block as darknet runs it, three max pools of the same input that are concatenated
+// clang-format off
+template <typename SUBNET>
+using spp_reference = dlib::concat4<dlib::tag4, dlib::tag3, dlib::tag2, dlib::tag1,
+                      dlib::tag4<dlib::max_pool<13, 13, 1, 1,
+                      dlib::skip1<
+                      dlib::tag3<dlib::max_pool<9, 9, 1, 1,
+                      dlib::skip1<
+                      dlib::tag2<dlib::max_pool<5, 5, 1, 1,
+                      dlib::tag1<SUBNET>>>>>>>>>>;
+// clang-format on
+
+// Compares the spp block of the networks, whose pools are cascaded, against the one of max
+// pools it replaced, at the input size of the spp blocks of yolov4 and yolov4-sam (512
+// channels) and of yolov4x (640 channels): the cascaded block must read the serialized block of
+// max pools, and their outputs must be identical.
+void bench_spp(const input_size img_size, const long iterations)
+{
+    const long nr = img_size.height / 32;
+    const long nc = img_size.width / 32;
+    std::cout << "spp: " << nc << "x" << nr << '\n';
+    for (const long k : {512, 640})
+    {
+        spp_reference<dlib::input_tensor> reference;
+        darknet::def<dlib::relu, dlib::affine>::spp<dlib::input_tensor> cascaded;
+        std::stringstream stream;
+        dlib::serialize(reference, stream);
+        dlib::deserialize(cascaded, stream);
+        dlib::resizable_tensor x(1, k, nr, nc);
+        dlib::tt::tensor_rand rnd(0);
+        rnd.fill_gaussian(x);
+        const float diff = dlib::max(dlib::abs(
+            dlib::mat(reference.forward(x)) - dlib::mat(cascaded.forward(x))));
+        if (diff != 0)
+            throw std::runtime_error("the cascaded spp differs by " + std::to_string(diff));
+        const double reference_us = time_us(iterations, [&] { reference.forward(x); });
+        const double cascaded_us = time_us(iterations, [&] { cascaded.forward(x); });
+        std::cout << "  " << k << " channels: max pools " << reference_us << " us, cascaded "
+                  << cascaded_us << " us, speedup " << reference_us / cascaded_us
+                  << "x, same output\n";
+    }
+}
+
+// A new empty file in the temporary directory, removed with the object.
+class temporary_file
+{
+    public:
+    explicit temporary_file(const std::string& prefix)
+        : path((std::filesystem::temp_directory_path() / (prefix + "XXXXXX")).string())
+    {
+        const int fd = mkstemp(path.data());
+        if (fd == -1)
+            throw std::runtime_error("unable to create the temporary file " + path);
+        close(fd);
+    }
+    temporary_file(const temporary_file&) = delete;
+    temporary_file& operator=(const temporary_file&) = delete;
+    ~temporary_file() { std::remove(path.c_str()); }
+
+    const std::string& get_path() const { return path; }
+
+    private:
+    std::string path;
+};
+
+// Compares the time to load a network saved by convert_weights with dlib::deserialize against
+// loading the same network from the memory-mappable format, which is written to a temporary
+// file, so the directory of the model is left untouched.
+void bench_load(
+    const model_entry& model,
+    const std::string& dnn_path,
+    const std::string& names_path,
+    const bool fused,
+    const long iterations)
+{
+    const temporary_file temp("bench_load_");
+    const std::string& mapped_path = temp.get_path();
+    model.load(dnn_path, names_path, fused)->save_mapped(mapped_path);
+    std::cout << "load: " << dnn_path << '\n';
+    const double deserialize_us =
+        time_us(iterations, [&] { model.load(dnn_path, names_path, fused); });
+    std::cout << "  deserialize: " << deserialize_us / 1000 << " ms\n";
+    const double mapped_us =
+        time_us(iterations, [&] { model.load(mapped_path, names_path, fused); });
+    std::cout << "  mapped:      " << mapped_us / 1000 << " ms, speedup "
+              << deserialize_us / mapped_us << "x\n";
+}
+
+// Settings of the end-to-end detection sweep.
+struct sweep_options
+{
+    std::vector<input_size> sizes{320, 416, 512, 608};
+    std::vector<long> batch_sizes{1, 2, 4};
+    long warmup = 5;
+    long iterations = 100;
+    float conf_thresh = 0.25;
+    float nms_thresh = 0.45;
+    bool plan_memory = false;
+};
+
+std::vector<long> parse_list(const std::string& list)
+{
+    std::vector<long> values;
+    for (const auto& item : dlib::split(list, ","))
+        values.push_back(std::stol(item));
+    return values;
+}
+
+// Resets the peak resident set size to the current one, so peak_rss_mb() gives the peak of the
+// next case instead of the peak of the whole process.  Only Linux supports it, through
+// /proc/self/clear_refs.
+bool reset_peak_rss()
+{
+    std::ofstream fout("/proc/self/clear_refs");
+    fout << "5" << std::flush;
+    return static_cast<bool>(fout);
+}
+
+// peak resident set size since the last reset_peak_rss(), or since the start of the process
+// where the peak can't be reset, in MiB
+double peak_rss_mb()
+{
+    std::ifstream fin("/proc/self/status");
+    for (std::string line; std::getline(fin, line);)
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::stol(line.substr(6)) / 1024.;  // in kB
+    }
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.;  // kilobytes on Linux
+}
+
+std::vector<dlib::matrix<dlib::rgb_pixel>> get_bench_images(const std::string& dir)
+{
+    std::vector<dlib::matrix<dlib::rgb_pixel>> images;
+    if (not dir.empty())
+    {
+        auto files = dlib::get_files_in_directory_tree(dir, dlib::match_endings(exts));
+        std::sort(files.begin(), files.end());
+        images.resize(files.size());
+        for (size_t i = 0; i < files.size(); ++i)
+            dlib::load_image(images[i], files[i].full_name());
+        if (images.empty())
+            throw std::runtime_error("no images found in " + dir);
+        return images;
+    }
+    // synthetic frames with the size of a 720p camera
+    dlib::rand rnd(0);
+    images.resize(8);
+    for (auto& image : images)
+    {
+        image.set_size(720, 1280);
+        for (auto& p : image)
+        {
+            p.red = rnd.get_random_8bit_number();
+            p.green = rnd.get_random_8bit_number();
+            p.blue = rnd.get_random_8bit_number();
+        }
+    }
+    return images;
+}
+
+double percentile(std::vector<double> values, const double p)
+{
+    std::sort(values.begin(), values.end());
+    return values[std::lround(p * (values.size() - 1))];
+}
+
+// Runs the detector over every image size and batch size of the sweep and prints one JSON
+// object per line for each case.  The latencies are per batch, the stage times per image.
+void bench_detect(
+    const std::string& model,
+    object_detector& detector,
+    const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+    const sweep_options& opts)
+{
+    detector.set_memory_planning(opts.plan_memory);
+    std::vector<dlib::matrix<dlib::rgb_pixel>> batch;
+    std::vector<std::vector<detection>> detections;
+    size_t next = 0;
+    // the batch is filled outside of the timed call, so the copies are not counted
+    const auto fill_batch = [&](const long batch_size)
+    {
+        batch.resize(batch_size);
+        for (auto& image : batch)
+            image = images[next++ % images.size()];
+    };
+    const auto run_batch = [&](const input_size size)
+    { detector.detect_batch(batch, detections, size, opts.conf_thresh, opts.nms_thresh); };
+    const auto to_ms = [](const detection_stage_times::duration d)
+    { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    for (const auto& size : opts.sizes)
+    {
+        for (const long batch_size : opts.batch_sizes)
+        {
+            const bool per_case_rss = reset_peak_rss();
+            for (long i = 0; i < opts.warmup; ++i)
+            {
+                fill_batch(batch_size);
+                run_batch(size);
+            }
+            detector.reset_stage_times();
+            std::vector<double> latencies(opts.iterations);
+            for (auto& latency : latencies)
+            {
+                fill_batch(batch_size);
+                latency = time_us(1, [&] { run_batch(size); }) / 1000;
+            }
+            const double total_ms = std::accumulate(latencies.begin(), latencies.end(), 0.);
+            const double num_images = opts.iterations * batch_size;
+            const auto& times = detector.get_stage_times();
+            std::cout << "{\"model\": \"" << model << "\", \"width\": " << size.width
+                      << ", \"height\": " << size.height << ", \"batch_size\": " << batch_size
+                      << ", \"iterations\": " << opts.iterations
+                      << ", \"p50_ms\": " << percentile(latencies, 0.5)
+                      << ", \"p90_ms\": " << percentile(latencies, 0.9)
+                      << ", \"p99_ms\": " << percentile(latencies, 0.99)
+                      << ", \"images_per_s\": " << 1000 * num_images / total_ms
+                      << ", \"preprocess_ms\": " << to_ms(times.preprocess) / num_images
+                      << ", \"forward_ms\": " << to_ms(times.forward) / num_images
+                      << ", \"add_detections_ms\": " << to_ms(times.decode) / num_images
+                      << ", \"nms_ms\": " << to_ms(times.nms) / num_images
+                      << ", \"peak_rss_mb\": " << peak_rss_mb()
+                      << ", \"peak_rss_per_case\": " << (per_case_rss ? "true" : "false");
+            if (const auto* planner = detector.get_activation_planner())
+            {
+                std::cout << ", \"activations_mb\": " << planner->get_planned_bytes() / 1048576.
+                          << ", \"unplanned_activations_mb\": "
+                          << planner->get_default_bytes() / 1048576.;
+            }
+            std::cout << "}" << std::endl;
+        }
+    }
+}
+
+int main(const int argc, const char** argv)
+try
+{
+    dlib::command_line_parser parser;
+    parser.add_option("decode", "benchmark the yolo output decoding against the scalar loop");
+    parser.add_option("nms", "benchmark the non-max suppression against the all-pairs loop");
+    parser.add_option("mish", "benchmark the vectorized mish against the scalar one");
+    parser.add_option("spp", "benchmark the cascaded spp block against the one of max pools");
+    parser.add_option("load", "benchmark loading a network saved by convert_weights", 1);
+    parser.add_option("model", get_model_names() + " (default: yolov4x-mish)", 1);
+    parser.add_option("fused", "the networks to load were converted with --fused");
+    parser.add_option("num-candidates", "number of candidates for --nms (default: 3000)", 1);
+    parser.add_option("img-size", "image size to process, N or WxH (default: 608)", 1);
+    parser.add_option("num-classes", "number of classes (default: 80)", 1);
+    parser.add_option("conf-thresh", "confidence threshold (default: 0.25)", 1);
+    parser.add_option("nms-thresh", "non-max suppression threshold (default: 0.45)", 1);
+    parser.add_option("iterations", "number of timed iterations (default: 100)", 1);
+    parser.set_group_name("Detection Options");
+    parser.add_option("detect", "benchmark the detectors given below end to end, as JSON lines");
+    parser.add_option("profile", "time every layer of a detector: " + get_model_names(), 1);
+    parser.add_option("trace", "save the --profile timings as a Chrome trace to this file", 1);
+    for (const auto& model : get_models())
+        parser.add_option(model.name, "path to the dlib model of " + model.name, 1);
+    parser.add_option("names", "path to file with label names (one per line)", 1);
+    parser.add_option("images", "directory with images (default: synthetic frames)", 1);
+    parser.add_option("sizes", "N or WxH sizes of --detect (default: 320,416,512,608)", 1);
+    parser.add_option("batch-sizes", "batch sizes of the --detect sweep (default: 1,2,4)", 1);
+    parser.add_option("plan-memory", "reuse the memory of the layer outputs with --detect");
+    parser.add_option("warmup", "iterations before the timed ones with --detect (default: 5)", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+    parser.check_sub_option("profile", "trace");
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+
+    const input_size img_size = parse_input_size(dlib::get_option(parser, "img-size", "608"));
+    const long num_classes = dlib::get_option(parser, "num-classes", 80);
+    const float conf_thresh = dlib::get_option(parser, "conf-thresh", 0.25);
+    const float nms_thresh = dlib::get_option(parser, "nms-thresh", 0.45);
+    const long num_candidates = dlib::get_option(parser, "num-candidates", 3000);
+    const long iterations = dlib::get_option(parser, "iterations", 100);
+    std::cout << std::fixed << std::setprecision(2);
+
+    if (parser.option("decode"))
+    {
+        bench_decode(img_size, num_classes, conf_thresh, false, iterations);
+        bench_decode(img_size, num_classes, conf_thresh, true, iterations);
+    }
+
+    if (parser.option("nms"))
+        bench_nms(num_candidates, num_classes, conf_thresh, nms_thresh, iterations);
+
+    if (parser.option("mish"))
+        bench_mish(img_size, iterations);
+
+    if (parser.option("spp"))
+        bench_spp(img_size, iterations);
+
+    const bool fused = parser.option("fused").count() > 0;
+    if (parser.option("load"))
+    {
+        const std::string names_path = dlib::get_option(parser, "names", "");
+        if (names_path.empty())
+            throw std::runtime_error("--load needs the label names with --names");
+        bench_load(
+            get_model(dlib::get_option(parser, "model", "yolov4x-mish")),
+            parser.option("load").argument(),
+            names_path,
+            fused,
+            iterations);
+    }
+
+    if (parser.option("detect") or parser.option("profile"))
+    {
+        const std::string names_path = dlib::get_option(parser, "names", "");
+        if (names_path.empty())
+            throw std::runtime_error("--detect and --profile need the label names with --names");
+        const auto images = get_bench_images(dlib::get_option(parser, "images", ""));
+        sweep_options opts;
+        if (parser.option("sizes"))
+        {
+            opts.sizes.clear();
+            for (const auto& size : dlib::split(parser.option("sizes").argument(), ","))
+                opts.sizes.push_back(parse_input_size(size));
+        }
+        if (parser.option("batch-sizes"))
+            opts.batch_sizes = parse_list(parser.option("batch-sizes").argument());
+        opts.warmup = dlib::get_option(parser, "warmup", 5);
+        opts.iterations = iterations;
+        opts.conf_thresh = conf_thresh;
+        opts.nms_thresh = nms_thresh;
+        opts.plan_memory = parser.option("plan-memory").count() > 0;
+        const std::string trace_path = dlib::get_option(parser, "trace", "");
+        const std::string profiled = dlib::get_option(parser, "profile", "");
+
+        long num_models = 0;
+        bool profiled_found = false;
+        for (const auto& model : get_models())
+        {
+            const std::string dnn_path = dlib::get_option(parser, model.name, "");
+            if (dnn_path.empty())
+                continue;
+            ++num_models;
+            const auto detector = model.load(dnn_path, names_path, fused);
+            if (parser.option("detect"))
+                bench_detect(model.name, *detector, images, opts);
+            if (profiled == model.name)
+            {
+                profiled_found = true;
+                detector->profile(images, img_size, iterations, std::cout, trace_path);
+            }
+        }
+        if (num_models == 0)
+            throw std::runtime_error("give the path to at least one model, e.g. --yolov4 path");
+        if (not profiled.empty() and not profiled_found)
+            throw std::runtime_error("give the path of the model to profile, e.g. --" + profiled);
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cout << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+#ifndef convert_h_INCLUDED
+#define convert_h_INCLUDED
+
+#include "darknet.h"
+#include "mapped_model.h"
+#include "models.h"
+#include "weights_visitor.h"
+
+// Runs both networks on the same random image and throws if the outputs of their yolo layers
+// differ by more than 1e-3 of their largest magnitude, e.g. to check that the fused network,
+// which folds the batch normalizations and reads its concatenations in place, computes the same
+// outputs as the infer one.
+template <typename net_a_type, typename net_b_type>
+void check_yolo_outputs(net_a_type& net_a, net_b_type& net_b, const long img_size)
+{
+    dlib::matrix<dlib::rgb_pixel> image(img_size, img_size);
+    dlib::rand rnd(0);
+    for (long r = 0; r < image.nr(); ++r)
+    {
+        for (long c = 0; c < image.nc(); ++c)
+        {
+            image(r, c) = dlib::rgb_pixel(
+                rnd.get_random_8bit_number(),
+                rnd.get_random_8bit_number(),
+                rnd.get_random_8bit_number());
+        }
+    }
+    net_a(image);
+    net_b(image);
+
+    const auto check = [](const std::string& name, const dlib::tensor& a, const dlib::tensor& b)
+    {
+        if (not dlib::have_same_dimensions(a, b))
+            throw std::runtime_error("the " + name + " outputs have different dimensions");
+        const float diff = dlib::max(dlib::abs(dlib::mat(a) - dlib::mat(b)));
+        const float range = dlib::max(dlib::abs(dlib::mat(a)));
+        std::cout << name << ": max abs difference " << diff << " (max abs output " << range
+                  << ")\n";
+        if (not (diff <= 1e-3f * std::max(1.f, range)))
+            throw std::runtime_error("the " + name + " outputs differ by " + std::to_string(diff));
+    };
+    using namespace darknet;
+    if constexpr (has_tag<net_a_type, ytag8>::value)
+        check("ytag8", layer<ytag8>(net_a).get_output(), layer<ytag8>(net_b).get_output());
+    check("ytag16", layer<ytag16>(net_a).get_output(), layer<ytag16>(net_b).get_output());
+    check("ytag32", layer<ytag32>(net_a).get_output(), layer<ytag32>(net_b).get_output());
+}
+
+// Loads the darknet weights into the network of a model and saves it.  The layer offset is 2
+// for yolov4x_mish, yolov4_csp and scaled_yolov4, and 1 for the previous models.  It is only
+// included by the translation units of the models, see models.h.
+template <
+    typename net_train_type,
+    typename net_infer_type,
+    typename net_fused_type,
+    unsigned int layer_offset>
+void convert(const conversion_options& options)
+{
+    // the network without --fused, converted from the training one, whose batch normalizations
+    // read the darknet weights
+    const auto load_infer = [&options]()
+    {
+        net_train_type net_train;
+        darknet::setup_detector<net_train_type, layer_offset>(
+            net_train,
+            options.num_classes,
+            options.img_size);
+        darknet::weights_visitor weights(options.weights_path);
+        dlib::visit_layers_backwards(net_train, weights);
+        weights.check_end();
+        net_train.clean();
+        return net_infer_type(net_train);
+    };
+
+    if (options.fused)
+    {
+        // the fused network reads the batch normalization parameters directly from the
+        // darknet weights and folds them into its convolutions
+        net_fused_type net_fused;
+        darknet::setup_detector<net_fused_type, layer_offset>(
+            net_fused,
+            options.num_classes,
+            options.img_size);
+        std::cout << "#params: " << dlib::count_parameters(net_fused) << '\n';
+        darknet::weights_visitor weights(options.weights_path);
+        dlib::visit_layers_backwards(net_fused, weights);
+        weights.check_end();
+        net_fused.clean();
+        if (options.check)
+        {
+            auto net_infer = load_infer();
+            check_yolo_outputs(net_infer, net_fused, options.img_size);
+            net_fused.clean();
+        }
+        if (options.precision == "f16")
+            darknet::set_precision(net_fused, darknet::fused_precision::f16);
+        else if (options.precision == "bf16")
+            darknet::set_precision(net_fused, darknet::fused_precision::bf16);
+        else if (options.precision != "f32")
+            throw std::runtime_error("unknown precision '" + options.precision + "'");
+        if (not options.save_path.empty())
+            dlib::serialize(options.save_path) << net_fused;
+        if (not options.save_mapped_path.empty())
+            darknet::save_mapped(net_fused, options.save_mapped_path);
+        if (options.print)
+            std::cout << net_fused << '\n';
+        return;
+    }
+
+    auto net_infer = load_infer();
+    std::cout << "#params: " << dlib::count_parameters(net_infer) << '\n';
+
+    if (not options.save_path.empty())
+        dlib::serialize(options.save_path) << net_infer;
+
+    if (not options.save_mapped_path.empty())
+        darknet::save_mapped(net_infer, options.save_mapped_path);
+
+    if (options.print)
+        std::cout << net_infer << '\n';
+}
+
+#endif  // convert_h_INCLUDED
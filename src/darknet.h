@@ -1,6 +1,8 @@
 #ifndef DarkNet_H
 #define DarkNet_H
 
+#include "layers.h"
+
 #include <dlib/dnn.h>
 
 namespace darknet
@@ -33,12 +35,64 @@ namespace darknet
     template <typename SUBNET> using ytag16 = add_tag_layer<4016, SUBNET>;
     template <typename SUBNET> using ytag32 = add_tag_layer<4032, SUBNET>;
 
+    // markers to build the inference networks with fused_con layers, e.g. def<fmish, fused>
+    template <typename SUBNET> struct fleaky;
+    template <typename SUBNET> struct fmish;
+    template <typename SUBNET> struct fused;
+    template <template <typename> class ACT> struct fused_act;
+    template <> struct fused_act<fleaky> { static constexpr fused_activation value = fused_activation::leaky; };
+    template <> struct fused_act<fmish> { static constexpr fused_activation value = fused_activation::mish; };
+
     template <template <typename> class ACT, template <typename> class BN>
-    struct def
+    struct blocks
     {
         template <long nf, long ks, int s, typename SUBNET>
         using conblock = ACT<BN<add_layer<con_<nf, ks, ks, s, s, ks/2, ks/2>, SUBNET>>>;
 
+        template <long nf, typename SUBNET>
+        using sigblock = sig<bn_con<con<nf, 1, 1, 1, 1, SUBNET>>>;
+
+        template <long nf, template <typename> class TAG1, template <typename> class TAG2, typename SUBNET>
+        using routeblock = conblock<nf, 1, 1, concat2<TAG1, TAG2, SUBNET>>;
+
+        template <typename SUBNET>
+        using upsample2 = upsample<2, SUBNET>;
+    };
+
+    template <template <typename> class ACT>
+    struct blocks<ACT, fused>
+    {
+        template <long nf, long ks, int s, typename SUBNET>
+        using conblock = fused_con<nf, ks, ks, s, s, fused_act<ACT>::value, SUBNET>;
+
+        template <long nf, typename SUBNET>
+        using sigblock = fused_con<nf, 1, 1, 1, 1, fused_activation::sigmoid, SUBNET>;
+
+        // the convolution reads the tagged tensors and upsamples the smaller one itself
+        template <long nf, template <typename> class TAG1, template <typename> class TAG2, typename SUBNET>
+        using routeblock = fused_con<nf, 1, 1, 1, 1, fused_act<ACT>::value, route2<TAG1, TAG2, SUBNET>>;
+
+        template <typename SUBNET>
+        using upsample2 = SUBNET;
+    };
+
+    template <template <typename> class ACT, template <typename> class BN>
+    struct def
+    {
+        template <long nf, long ks, int s, typename SUBNET>
+        using conblock = typename blocks<ACT, BN>::template conblock<nf, ks, s, SUBNET>;
+
+        template <long nf, typename SUBNET>
+        using sigblock = typename blocks<ACT, BN>::template sigblock<nf, SUBNET>;
+
+        // a 1x1 conblock on the concatenation of the tensors tagged with TAG1 and TAG2, whose
+        // upsampled branch goes through upsample2: the fused networks never write either
+        template <long nf, template <typename> class TAG1, template <typename> class TAG2, typename SUBNET>
+        using routeblock = typename blocks<ACT, BN>::template routeblock<nf, TAG1, TAG2, SUBNET>;
+
+        template <typename SUBNET>
+        using upsample2 = typename blocks<ACT, BN>::template upsample2<SUBNET>;
+
         template <long nf1, long nf2, typename SUBNET>
         using residual = add_prev1<
                          conblock<nf1, 3, 1,
@@ -67,6 +121,17 @@ namespace darknet
                           conblock<nf * factor, 3, 1,
                           conblock<nf, 1, 1, SUBNET>>>>>;
 
+        // conblock4 and conblock5 on top of their first 1x1 conblock, given as SUBNET, e.g. a
+        // routeblock
+        template <long nf, long factor, typename SUBNET>
+        using conblock4_on = conblock<nf * factor, 3, 1,
+                             conblock<nf, 1, 1,
+                             conblock<nf * factor, 3, 1, SUBNET>>>;
+
+        template <long nf, long factor, typename SUBNET>
+        using conblock5_on = conblock<nf, 1, 1,
+                             conblock4_on<nf, factor, SUBNET>>;
+
         template <long nf, long factor, typename SUBNET>
         using conblock6 = conblock<nf * factor, 3, 1,
                           conblock<nf, 1, 1,
@@ -105,15 +170,14 @@ namespace darknet
        template <typename SUBNET> using resv4_512 = resv4<512, SUBNET>;
 
         template <long nf, long factor, size_t N, template <typename> class RES, typename SUBNET>
-        using cspblock = conblock<nf * factor, 1, 1,
-                         concat2<tag1, tag2,
+        using cspblock = routeblock<nf * factor, tag1, tag2,
                     tag1<conblock<nf, 1, 1,
                          repeat<N, RES,
                          conblock<nf, 1, 1,
                          skip1<
                     tag2<conblock<nf, 1, 1,
                     tag1<conblock<nf * factor, 3, 2,
-                         SUBNET>>>>>>>>>>>;
+                         SUBNET>>>>>>>>>>;
 
         template <typename INPUT>
         using backbone53csp = cspblock<512, 2, 4, resv4_512,
@@ -124,19 +188,23 @@ namespace darknet
                               conblock<32, 3, 1,
                               INPUT>>>>>>>>;
 
+        // the concatenation of the 13x13, 9x9 and 5x5 max pools and the input, as in darknet,
+        // where the 9x9 and 13x13 pools are cascades of 5x5 pools of the smaller ones
         template <typename SUBNET>
-        using spp = concat4<tag4, tag3, tag2, tag1, // 113
-               tag4<max_pool<13, 13, 1, 1,          // 112
-                    skip1<                          // 111
-               tag3<max_pool<9, 9, 1, 1,            // 110
-                    skip1<                          // 109
-               tag2<max_pool<5, 5, 1, 1,            // 108
+        using spp = concat4<tag4, tag3, tag2, tag1,     // 113
+               tag4<cascaded_max_pool<13, 5,            // 112
+                    skip1<                              // 111
+               tag3<cascaded_max_pool<9, 5,             // 110
+                    skip1<                              // 109
+               tag2<cascaded_max_pool<5, 5,             // 108
                tag1<SUBNET>>>>>>>>>>;
 
+        // the heads of a scale, on top of the first 1x1 conblock of their conblock5 or conblock4,
+        // given as SUBNET, which is a routeblock on a concatenation
         template <long nf, int classes, template <typename> class YTAG, template <typename> class NTAG, typename SUBNET>
         using yolo = YTAG<con<3 * (classes + 5), 1, 1, 1, 1,
                      conblock<nf, 3, 1,
-                NTAG<conblock5<nf / 2, 2,
+                NTAG<conblock5_on<nf / 2, 2,
                      SUBNET>>>>>;
 
         template <long nf, int classes, template <typename> class YTAG, template <typename> class NTAG, typename SUBNET>
@@ -144,128 +212,121 @@ namespace darknet
                          conblock<nf, 3, 1,
                     NTAG<conblock<nf / 2, 1, 1,
                          mult_prev1<
-                         sig<bn_con<con<nf, 1, 1, 1, 1,
-                    tag1<conblock4<nf * 2, 2,
-                         SUBNET>>>>>>>>>>>;
+                         sigblock<nf,
+                    tag1<conblock4_on<nf * 2, 2,
+                         SUBNET>>>>>>>>>;
 
         template <int classes>
         using yolov3 = yolo<256, classes, ytag8, ntag8,
-                       concat2<htag8, btag8,
-                 htag8<upsample<2, conblock<128, 1, 1,
+                       routeblock<128, htag8, btag8,
+                 htag8<upsample2<conblock<128, 1, 1,
                        nskip16<
                        yolo<512, classes, ytag16, ntag16,
-                       concat2<htag16, btag16,
-                htag16<upsample<2, conblock<256, 1, 1,
+                       routeblock<256, htag16, btag16,
+                htag16<upsample2<conblock<256, 1, 1,
                        nskip32<
                        yolo<1024, classes, ytag32, ntag32,
+                       conblock<512, 1, 1,
                        backbone53<tag1<input_rgb_image>>
-                       >>>>>>>>>>>>>;
+                       >>>>>>>>>>>>>>;
 
         template <int classes, typename SUBNET>
         using yolov4 = yolo<1024, classes, ytag32, ntag32,  // 161
-                       concat2<htag32, ntag32,              // 153
+                       routeblock<512, htag32, ntag32,      // 153
                 htag32<conblock<512, 3, 2,                  // 152
                        nskip16<                             // 151
                        yolo<512, classes, ytag16, ntag16,   // 150
-                       concat2<htag16, ntag16,              // 142
+                       routeblock<256, htag16, ntag16,      // 142
                 htag16<conblock<256, 3, 2,                  // 141
                        nskip8<                              // 140
                        yolo<256, classes, ytag8, ntag8,     // 139
-                       concat2<tag1, tag2,                  // 131
+                       routeblock<128, tag1, tag2,          // 131
                   tag1<conblock<128, 1, 1,                  // 130
                        bskip8<                              // 129
-                  tag2<upsample<2,                          // 128
+                  tag2<upsample2<                           // 128
                        conblock<128, 1, 1,                  // 127
-                ntag16<conblock5<256, 2,                    // 126
-                       concat2<tag1, tag2,                  // 121
+                ntag16<conblock5_on<256, 2,                 // 126
+                       routeblock<256, tag1, tag2,          // 121
                   tag1<conblock<256, 1, 1,                  // 120
                        bskip16<                             // 119
-                  tag2<upsample<2,                          // 118
+                  tag2<upsample2<                           // 118
                        conblock<256, 1, 1,                  // 117
-                ntag32<conblock3<512, 2,
-                       spp<
+                ntag32<conblock3<512, 2,                    // 116
+                       spp<                                 // 108 - 113
                        conblock3<512, 2,                    // 107
                        SUBNET>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>;
 
         template <int classes, typename SUBNET>
         using yolov4_sam = yolo_sam<1024, classes, ytag32, ntag32,  // 161
-                           concat2<htag32, ntag32,                  // 153
+                           routeblock<2048, htag32, ntag32,         // 153
                     htag32<conblock<512, 3, 2,                      // 152
                            nskip16<                                 // 151
                            yolo_sam<512, classes, ytag16, ntag16,   // 150
-                           concat2<htag16, ntag16,                  // 142
+                           routeblock<1024, htag16, ntag16,         // 142
                     htag16<conblock<256, 3, 2,                      // 141
                            nskip8<                                  // 140
                            yolo_sam<256, classes, ytag8, ntag8,     // 139
-                           concat2<tag1, tag2,                      // 131
+                           routeblock<512, tag1, tag2,              // 131
                       tag1<conblock<128, 1, 1,                      // 130
                            bskip8<                                  // 129
-                      tag2<upsample<2,                              // 128
+                      tag2<upsample2<                               // 128
                            conblock<128, 1, 1,                      // 127
-                    ntag16<conblock5<256, 2,                        // 126
-                           concat2<tag1, tag2,                      // 121
+                    ntag16<conblock5_on<256, 2,                     // 126
+                           routeblock<256, tag1, tag2,              // 121
                       tag1<conblock<256, 1, 1,                      // 120
                            bskip16<                                 // 119
-                      tag2<upsample<2,                              // 118
+                      tag2<upsample2<                               // 118
                            conblock<256, 1, 1,                      // 117
-                    ntag32<conblock3<512, 2,
-                           spp<
+                    ntag32<conblock3<512, 2,                        // 116
+                           spp<                                     // 108 - 113
                            conblock3<512, 2,                        // 107
                            SUBNET>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>;
 
         template <typename INPUT>
         using yolov4x = ytag32<                         // 202
                         sig<con<255, 1, 1, 1, 1,        // 201
-                        conblock2<640, 2,               // 200
-                        concat2<tag1, tag2, // 197 190  // 198
+                        conblock<1280, 3, 1,            // 200
+                        routeblock<640, tag1, tag2, // 197 190  // 198 199
                    tag1<conblock6<640, 1,               // 197
                         skip1< // 189                   // 191
                    tag2<conblock<640, 1, 1,             // 190
-                   tag1<conblock<640, 1, 1,             // 189
-                        concat2<tag1, tag9, // 187 133  // 188
+                   tag1<routeblock<640, tag1, tag9, // 187 133 // 188 189
                    tag1<conblock<640, 3, 2,             // 187
                         skip1< // 182                   // 186
                         ytag16<                         // 185
                         sig<con<255, 1, 1, 1, 1,        // 184
                         conblock<640, 3, 1,             // 183
-                   tag1<conblock<320, 1, 1,             // 182
-                        concat2<tag1, tag2, // 180 173  // 181
+                   tag1<routeblock<320, tag1, tag2, // 180 173 // 181 182
                    tag1<conblock6<320, 1,               // 180
                         skip1< // 172                   // 174
                    tag2<conblock<320, 1, 1,             // 173
-                   tag1<conblock<320, 1, 1,             // 172
-                        concat2<tag1, tag8, // 170 149  // 171
+                   tag1<routeblock<320, tag1, tag8, // 170 149 // 171 172
                    tag1<conblock<320, 3, 2,             // 170
                         skip1< // 165                   // 169
                         ytag8<                          // 168
                         sig<con<255, 1, 1, 1, 1,        // 167
                         conblock<320, 3, 1,             // 166
-                   tag1<conblock<160, 1, 1,             // 165
-                        concat2<tag1, tag2, // 163 156  // 164
+                   tag1<routeblock<160, tag1, tag2, // 163 156 // 164 165
                    tag1<conblock6<160, 1,               // 163
                         skip1< // 155                   // 157
                    tag2<conblock<160, 1, 1,             // 156
-                   tag1<conblock<160, 1, 1,             // 155
-                        concat2<tag1, tag2, // 153 151  // 154
+                   tag1<routeblock<160, tag1, tag2, // 153 151 // 154 155
                    tag1<conblock<160, 1, 1,             // 153
                         skip7< // 57                    // 152
-                   tag2<upsample<2,                     // 151
+                   tag2<upsample2<                      // 151
                         conblock<160, 1, 1,             // 150
-                   tag8<conblock<320, 1, 1,             // 149
-                        concat2<tag1, tag2, // 147 140  // 148
+                   tag8<routeblock<320, tag1, tag2, // 147 140 // 148 149
                    tag1<conblock6<320, 1,               // 147
                         skip1< // 139                   // 141
                    tag2<conblock<320, 1, 1,             // 140
-                   tag1<conblock<320, 1, 1,             // 139
-                        concat2<tag1, tag2, // 137 135  // 138
+                   tag1<routeblock<320, tag1, tag2, // 137 135 // 138 139
                    tag1<conblock<320, 1, 1,             // 137
                         skip6< // 94                    // 136
-                   tag2<upsample<2,                     // 135
+                   tag2<upsample2<                      // 135
                         conblock<320, 1, 1,             // 134
-                   tag9<conblock<640, 1, 1,             // 133
-                        concat2<tag1, tag5, // 131 117  // 132
+                   tag9<routeblock<640, tag1, tag5, // 131 117 // 132 133
                    tag1<conblock4<640, 1,               // 131
-                        spp<
+                        spp<                            // 122 - 127
                         conblock3<640, 1,               // 121
                         skip1< // 116                   // 118
                    tag5<conblock<640, 1, 1,             // 117
@@ -279,25 +340,129 @@ namespace darknet
                         INPUT>
                         >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
                         >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-                        >>>>>>>>>>>>>>>;
+                        >>>>>>>;
+
+        // the CSP block of yolov4-tiny: the second half of the channels of a convolution goes
+        // through two convolutions, whose outputs are concatenated, merged by a 1x1 convolution
+        // tagged with TAG and concatenated with the first convolution
+        template <long nf, template <typename> class TAG, typename SUBNET>
+        using cspblock_tiny = concat2<tag3, TAG,
+                         TAG<routeblock<nf, tag1, tag2,
+                        tag1<conblock<nf / 2, 3, 1,
+                        tag2<conblock<nf / 2, 3, 1,
+                             route_group<2, 1,
+                        tag3<conblock<nf, 3, 1,
+                             SUBNET>>>>>>>>>>;
+
+        template <typename INPUT>
+        using backbone_tiny = conblock<512, 3, 1,           // 26
+                              max_pool<2, 2, 2, 2,          // 25
+                              cspblock_tiny<256, btag16,    // 18
+                              max_pool<2, 2, 2, 2,          // 17
+                              cspblock_tiny<128, tag1,      // 10
+                              max_pool<2, 2, 2, 2,          // 9
+                              cspblock_tiny<64, tag1,       // 2
+                              conblock<64, 3, 2,            // 1
+                              conblock<32, 3, 2,            // 0
+                              INPUT>>>>>>>>>;
+
+        // the two yolo outputs of the tiny models, at strides 32 and 16
+        template <int classes, typename SUBNET>
+        using yolo_tiny = ytag16<con<3 * (classes + 5), 1, 1, 1, 1,
+                          conblock<256, 3, 1,
+                          concat2<htag16, btag16,
+                   htag16<upsample<2,
+                          conblock<128, 1, 1,
+                          nskip32<
+                          ytag32<con<3 * (classes + 5), 1, 1, 1, 1,
+                          conblock<512, 3, 1,
+                   ntag32<conblock<256, 1, 1,
+                          SUBNET>>>>>>>>>>>>>;
 
+        template <int classes>
+        using yolov3_tiny = yolo_tiny<classes,
+                            conblock<1024, 3, 1,            // 12
+                            same_max_pool<2,                // 11
+                            conblock<512, 3, 1,             // 10
+                            max_pool<2, 2, 2, 2,            // 9
+                     btag16<conblock<256, 3, 1,             // 8
+                            max_pool<2, 2, 2, 2,            // 7
+                            conblock<128, 3, 1,             // 6
+                            max_pool<2, 2, 2, 2,            // 5
+                            conblock<64, 3, 1,              // 4
+                            max_pool<2, 2, 2, 2,            // 3
+                            conblock<32, 3, 1,              // 2
+                            max_pool<2, 2, 2, 2,            // 1
+                            conblock<16, 3, 1,              // 0
+                            tag1<input_rgb_image>>>>>>>>>>>>>>>>;
 
+        template <int classes>
+        using yolov4_tiny = yolo_tiny<classes, backbone_tiny<tag1<input_rgb_image>>>;
     };
 
     using yolov3_train = def<leaky_relu, bn_con>::yolov3<80>;
     using yolov3_infer = def<leaky_relu, affine>::yolov3<80>;
+    using yolov3_fused = def<fleaky, fused>::yolov3<80>;
 
     using yolov4_train = def<leaky_relu, bn_con>::yolov4<80, def<mish, bn_con>::backbone53csp<tag1<input_rgb_image>>>;
-    using yolov4_infer = def<leaky_relu, affine>::yolov4<80, def<mish, affine>::backbone53csp<tag1<input_rgb_image>>>;
+    using yolov4_infer = def<leaky_relu, affine>::yolov4<80, def<fast_mish, affine>::backbone53csp<tag1<input_rgb_image>>>;
+    using yolov4_fused = def<fleaky, fused>::yolov4<80, def<fmish, fused>::backbone53csp<tag1<input_rgb_image>>>;
 
     using yolov4_sam_mish_train = def<mish, bn_con>::yolov4_sam<80, def<mish, bn_con>::backbone53csp<tag1<input_rgb_image>>>;
-    using yolov4_sam_mish_infer = def<mish, affine>::yolov4_sam<80, def<mish, affine>::backbone53csp<tag1<input_rgb_image>>>;
+    using yolov4_sam_mish_infer = def<fast_mish, affine>::yolov4_sam<80, def<fast_mish, affine>::backbone53csp<tag1<input_rgb_image>>>;
+    using yolov4_sam_mish_fused = def<fmish, fused>::yolov4_sam<80, def<fmish, fused>::backbone53csp<tag1<input_rgb_image>>>;
 
     using yolov4x_mish_train = def<mish, bn_con>::yolov4x<tag1<input_rgb_image>>;
-    using yolov4x_mish_infer = def<mish, affine>::yolov4x<tag1<input_rgb_image>>;
+    using yolov4x_mish_infer = def<fast_mish, affine>::yolov4x<tag1<input_rgb_image>>;
+    using yolov4x_mish_fused = def<fmish, fused>::yolov4x<tag1<input_rgb_image>>;
+
+    using yolov3_tiny_train = def<leaky_relu, bn_con>::yolov3_tiny<80>;
+    using yolov3_tiny_infer = def<leaky_relu, affine>::yolov3_tiny<80>;
+    using yolov3_tiny_fused = def<fleaky, fused>::yolov3_tiny<80>;
+
+    using yolov4_tiny_train = def<leaky_relu, bn_con>::yolov4_tiny<80>;
+    using yolov4_tiny_infer = def<leaky_relu, affine>::yolov4_tiny<80>;
+    using yolov4_tiny_fused = def<fleaky, fused>::yolov4_tiny<80>;
 
     // clang-format on
 
+    namespace detail
+    {
+        template <typename T> struct tag_id;
+        template <unsigned long ID, typename SUBNET, typename E>
+        struct tag_id<add_tag_layer<ID, SUBNET, E>> : std::integral_constant<unsigned long, ID>
+        {
+        };
+
+        template <typename NET, unsigned long ID> struct has_tag_id : std::false_type
+        {
+        };
+        template <typename DETAILS, typename SUBNET, typename E, unsigned long ID>
+        struct has_tag_id<add_layer<DETAILS, SUBNET, E>, ID> : has_tag_id<SUBNET, ID>
+        {
+        };
+        template <unsigned long TAG_ID, typename SUBNET, typename E, unsigned long ID>
+        struct has_tag_id<add_tag_layer<TAG_ID, SUBNET, E>, ID>
+            : std::bool_constant<TAG_ID == ID or has_tag_id<SUBNET, ID>::value>
+        {
+        };
+        template <template <typename> class TAG, typename SUBNET, unsigned long ID>
+        struct has_tag_id<add_skip_layer<TAG, SUBNET>, ID> : has_tag_id<SUBNET, ID>
+        {
+        };
+        template <size_t N, template <typename> class REPEATED, typename SUBNET, unsigned long ID>
+        struct has_tag_id<repeat<N, REPEATED, SUBNET>, ID> : has_tag_id<SUBNET, ID>
+        {
+        };
+    }  // namespace detail
+
+    // True if the network has a layer tagged with TAG outside of its repeat layers, e.g. the
+    // tiny models have no ytag8 output.
+    template <typename net_type, template <typename> class TAG>
+    struct has_tag : detail::has_tag_id<net_type, detail::tag_id<TAG<input_rgb_image>>::value>
+    {
+    };
+
     template <typename net_type, unsigned int offset = 1>
     void setup_detector(net_type& net, int num_classes = 80, size_t img_size = 416)
     {
@@ -308,7 +473,8 @@ namespace darknet
         // setup leaky relus
         visit_computational_layers(net, [](leaky_relu_& l) { l = leaky_relu_(0.1); });
         // set the number of filters
-        layer<ytag8, offset>(net).layer_details().set_num_filters(3 * (num_classes + 5));
+        if constexpr (has_tag<net_type, ytag8>::value)
+            layer<ytag8, offset>(net).layer_details().set_num_filters(3 * (num_classes + 5));
         layer<ytag16, offset>(net).layer_details().set_num_filters(3 * (num_classes + 5));
         layer<ytag32, offset>(net).layer_details().set_num_filters(3 * (num_classes + 5));
         // allocate the network
@@ -0,0 +1,142 @@
+#ifndef detector_h_INCLUDED
+#define detector_h_INCLUDED
+
+#include "activation_planner.h"
+#include "yolo_utils.h"
+
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Time spent in each stage of the detection, accumulated over the calls since the last reset.
+struct detection_stage_times
+{
+    using duration = std::chrono::steady_clock::duration;
+    duration preprocess{0};
+    duration forward{0};
+    duration decode{0};  // add_detections
+    duration nms{0};
+};
+
+// Width and height of the network input, both rounded to the nearest multiple of 32, the
+// largest stride of the yolo outputs.  A single size gives a square input.
+struct input_size
+{
+    input_size(const long size) : input_size(size, size) {}
+    input_size(const long width, const long height) : width(round(width)), height(round(height))
+    {
+    }
+
+    long width;
+    long height;
+
+    private:
+    static long round(const long size) { return std::max(1l, (size + 16) / 32) * 32; }
+};
+
+// Parses an input size given as "416" or as "WxH", e.g. "640x384".
+inline input_size parse_input_size(const std::string& text)
+{
+    std::istringstream sin(text);
+    long width = 0, height = 0;
+    char separator = 'x';
+    sin >> width;
+    if (sin.eof())
+        height = width;
+    else
+        sin >> separator >> height;
+    if (sin.fail() or not sin.eof() or (separator != 'x' and separator != 'X') or width <= 0 or
+        height <= 0)
+        throw std::runtime_error("invalid input size '" + text + "', expected N or WxH");
+    return input_size(width, height);
+}
+
+// Settings of yolo_detector::detect_tiled.
+struct tiling_options
+{
+    // width of the tiles in pixels of the source image, their height follows the aspect ratio of
+    // the network input (0: the network input size, so the tiles keep their native resolution)
+    long tile_size = 0;
+    // fraction of each tile shared with its neighbours, so objects cut at a seam are seen whole
+    // in one of the tiles
+    float overlap = 0.2;
+    // also run the whole image scaled to the network input size, to find the objects that are
+    // larger than a tile
+    bool full_frame = false;
+    // number of tiles run through the network at once
+    long batch_size = 4;
+};
+
+// The interface of the detectors, which lets the tools pick the model at runtime instead of
+// compiling the networks of every model they support, see get_model() in models.h.  Every
+// yolo_detector implements it.
+class object_detector
+{
+    public:
+    virtual ~object_detector() = default;
+
+    virtual void detect(
+        const dlib::image_view<dlib::matrix<dlib::rgb_pixel>> image,
+        std::vector<detection>& detections,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45) = 0;
+
+    virtual void detect_batch(
+        const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+        std::vector<std::vector<detection>>& detections,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45) = 0;
+
+    virtual void detect_tiled(
+        const dlib::matrix<dlib::rgb_pixel>& image,
+        std::vector<detection>& detections,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45,
+        const tiling_options& options = tiling_options()) = 0;
+
+    virtual const std::vector<std::string>& get_labels() const = 0;
+
+    virtual void set_letterbox(const bool enable) = 0;
+    virtual bool get_letterbox() const = 0;
+
+    virtual void set_nms_options(const nms_options& options) = 0;
+    virtual const nms_options& get_nms_options() const = 0;
+
+    virtual void set_memory_planning(const bool enable) = 0;
+    virtual bool get_memory_planning() const = 0;
+    virtual const darknet::activation_planner_base* get_activation_planner() const = 0;
+
+    virtual const detection_stage_times& get_stage_times() const = 0;
+    virtual void reset_stage_times() = 0;
+
+    virtual void print() const = 0;
+
+    // saves the network in dlib format, or in the memory-mappable one of save_mapped()
+    virtual void save(const std::string& path) const = 0;
+    virtual void save_mapped(const std::string& path) const = 0;
+
+    // Post-training int8 quantization of the fused_con layers: calibrate by running images
+    // while calibrating, then quantize, which returns the number of quantized layers (none in
+    // the networks converted without --fused).
+    virtual void set_calibrating(const bool value) = 0;
+    virtual size_t quantize_int8() = 0;
+
+    // Times every layer of the network on the images resized to image_size, prints the summary
+    // and optionally saves the Chrome trace, see darknet::layer_profiler.
+    virtual void profile(
+        const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+        const input_size image_size,
+        const long iterations,
+        std::ostream& out,
+        const std::string& trace_path = "") = 0;
+
+    // a copy of the detector with its own network, e.g. for another thread
+    virtual std::unique_ptr<object_detector> clone() const = 0;
+};
+
+#endif  // detector_h_INCLUDED
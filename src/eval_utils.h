@@ -0,0 +1,134 @@
+#ifndef eval_utils_h_INCLUDED
+#define eval_utils_h_INCLUDED
+
+#include "detector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <dlib/dir_nav.h>
+#include <dlib/image_io.h>
+#include <string>
+#include <vector>
+
+// Helpers of the tools that compare a modified detector, e.g. quantized or pruned, against the
+// original one on a directory of images.
+
+// Loads the first images of a directory tree, in the order of their paths.
+inline std::vector<dlib::matrix<dlib::rgb_pixel>> load_images(
+    const std::string& dir,
+    const size_t max_images)
+{
+    const std::string exts{".jpg .JPG .jpeg .JPEG .png .PNG .gif .GIF"};
+    auto files = dlib::get_files_in_directory_tree(dir, dlib::match_endings(exts));
+    std::sort(files.begin(), files.end());
+    if (files.size() > max_images)
+        files.resize(max_images);
+    std::vector<dlib::matrix<dlib::rgb_pixel>> images(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        dlib::load_image(images[i], files[i].full_name());
+    return images;
+}
+
+// Mean over the classes of the average precision of the detections against the reference
+// detections, with the all-point interpolation of the Pascal VOC metric.
+inline double mean_average_precision(
+    const std::vector<std::vector<detection>>& references,
+    const std::vector<std::vector<detection>>& detections,
+    const size_t num_classes,
+    const float iou_thresh = 0.5)
+{
+    struct scored
+    {
+        float score;
+        bool true_positive;
+    };
+    std::vector<std::vector<scored>> per_class(num_classes);
+    std::vector<long> num_references(num_classes, 0);
+    for (size_t i = 0; i < references.size(); ++i)
+    {
+        for (const auto& r : references[i])
+            ++num_references[r.id];
+        std::vector<bool> matched(references[i].size(), false);
+        auto dets = detections[i];
+        std::sort(
+            dets.begin(),
+            dets.end(),
+            [](const detection& a, const detection& b) { return a.score > b.score; });
+        for (const auto& d : dets)
+        {
+            float best_iou = iou_thresh;
+            long best = -1;
+            for (size_t j = 0; j < references[i].size(); ++j)
+            {
+                const auto& r = references[i][j];
+                if (matched[j] or r.id != d.id)
+                    continue;
+                const float overlap = iou(d, r, IOU);
+                if (overlap >= best_iou)
+                {
+                    best_iou = overlap;
+                    best = j;
+                }
+            }
+            if (best >= 0)
+                matched[best] = true;
+            per_class[d.id].push_back({d.score, best >= 0});
+        }
+    }
+
+    double sum_ap = 0;
+    long num_valid_classes = 0;
+    for (size_t c = 0; c < num_classes; ++c)
+    {
+        if (num_references[c] == 0)
+            continue;
+        ++num_valid_classes;
+        auto& dets = per_class[c];
+        std::sort(
+            dets.begin(),
+            dets.end(),
+            [](const scored& a, const scored& b) { return a.score > b.score; });
+        std::vector<double> precision(dets.size()), recall(dets.size());
+        long tp = 0;
+        for (size_t i = 0; i < dets.size(); ++i)
+        {
+            tp += dets[i].true_positive;
+            precision[i] = static_cast<double>(tp) / (i + 1);
+            recall[i] = static_cast<double>(tp) / num_references[c];
+        }
+        for (long i = static_cast<long>(dets.size()) - 2; i >= 0; --i)
+            precision[i] = std::max(precision[i], precision[i + 1]);
+        double ap = 0, prev_recall = 0;
+        for (size_t i = 0; i < dets.size(); ++i)
+        {
+            ap += (recall[i] - prev_recall) * precision[i];
+            prev_recall = recall[i];
+        }
+        sum_ap += ap;
+    }
+    return num_valid_classes > 0 ? sum_ap / num_valid_classes : 1;
+}
+
+// Runs the detector on every image and returns the mean time per image, in ms.  The images are
+// taken by non-const reference since the detector reads them through an image_view.
+inline double detect_all(
+    object_detector& detector,
+    std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+    std::vector<std::vector<detection>>& detections,
+    const input_size image_size,
+    const float conf_thresh,
+    const float nms_thresh)
+{
+    detections.resize(images.size());
+    const auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        // detect() appends to the detections
+        detections[i].clear();
+        detector.detect(images[i], detections[i], image_size, conf_thresh, nms_thresh);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count() / images.size();
+}
+
+#endif  // eval_utils_h_INCLUDED
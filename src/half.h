@@ -0,0 +1,156 @@
+#ifndef darknet_half_h_INCLUDED
+#define darknet_half_h_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Conversions between float and the 16-bit IEEE half (f16) and brain float (bf16) formats used
+// to store the weights of the fused layers.  Narrowing rounds to the nearest even value.  The
+// f16 conversions use the F16C instructions when they are enabled.
+namespace darknet
+{
+    inline uint16_t float_to_f16(const float value)
+    {
+        uint32_t x;
+        std::memcpy(&x, &value, sizeof(x));
+        const uint16_t sign = (x >> 16) & 0x8000;
+        const uint32_t biased_exp = (x >> 23) & 0xff;
+        uint32_t mantissa = x & 0x7fffff;
+        // infinity and NaN
+        if (biased_exp == 0xff)
+            return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+        const int32_t exp = static_cast<int32_t>(biased_exp) - 127 + 15;
+        if (exp >= 31)
+            return sign | 0x7c00;
+        if (exp <= 0)
+        {
+            // subnormal half, or zero if the value is too small
+            if (exp < -10)
+                return sign;
+            mantissa |= 0x800000;
+            const uint32_t shift = 14 - exp;
+            uint32_t h = mantissa >> shift;
+            const uint32_t remainder = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway or (remainder == halfway and (h & 1)))
+                ++h;
+            return sign | h;
+        }
+        uint32_t h = (exp << 10) | (mantissa >> 13);
+        const uint32_t remainder = mantissa & 0x1fff;
+        // a carry out of the mantissa correctly bumps the exponent
+        if (remainder > 0x1000 or (remainder == 0x1000 and (h & 1)))
+            ++h;
+        return sign | h;
+    }
+
+    inline float f16_to_float(const uint16_t h)
+    {
+        const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+        uint32_t exp = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t x;
+        if (exp == 0x1f)
+        {
+            x = sign | 0x7f800000 | (mantissa << 13);
+        }
+        else if (exp == 0)
+        {
+            if (mantissa == 0)
+            {
+                x = sign;
+            }
+            else
+            {
+                // normalize the subnormal half
+                exp = 127 - 15 + 1;
+                while ((mantissa & 0x400) == 0)
+                {
+                    mantissa <<= 1;
+                    --exp;
+                }
+                x = sign | (exp << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        }
+        else
+        {
+            x = sign | ((exp + 127 - 15) << 23) | (mantissa << 13);
+        }
+        float value;
+        std::memcpy(&value, &x, sizeof(value));
+        return value;
+    }
+
+    inline uint16_t float_to_bf16(const float value)
+    {
+        uint32_t x;
+        std::memcpy(&x, &value, sizeof(x));
+        // keep NaN a NaN instead of rounding it to infinity
+        if ((x & 0x7fffffff) > 0x7f800000)
+            return (x >> 16) | 0x40;
+        x += 0x7fff + ((x >> 16) & 1);
+        return x >> 16;
+    }
+
+    inline float bf16_to_float(const uint16_t h)
+    {
+        const uint32_t x = static_cast<uint32_t>(h) << 16;
+        float value;
+        std::memcpy(&value, &x, sizeof(value));
+        return value;
+    }
+
+    inline void narrow_to_f16(const float* src, uint16_t* dst, const size_t n)
+    {
+        size_t i = 0;
+#if defined(__F16C__)
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+        }
+#endif
+        for (; i < n; ++i)
+            dst[i] = float_to_f16(src[i]);
+    }
+
+    inline void widen_from_f16(const uint16_t* src, float* dst, const size_t n)
+    {
+        size_t i = 0;
+#if defined(__F16C__)
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+        }
+#endif
+        for (; i < n; ++i)
+            dst[i] = f16_to_float(src[i]);
+    }
+
+    inline void narrow_to_bf16(const float* src, uint16_t* dst, const size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = float_to_bf16(src[i]);
+    }
+
+    inline void widen_from_bf16(const uint16_t* src, float* dst, const size_t n)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(x));
+        }
+#endif
+        for (; i < n; ++i)
+            dst[i] = bf16_to_float(src[i]);
+    }
+}  // namespace darknet
+
+#endif  // darknet_half_h_INCLUDED
@@ -0,0 +1,1298 @@
+#ifndef darknet_layers_h_INCLUDED
+#define darknet_layers_h_INCLUDED
+
+#include "half.h"
+#include "mish.h"
+#include "quantized_conv.h"
+
+#include <cmath>
+#include <dlib/dnn.h>
+#include <dlib/threads.h>
+#include <type_traits>
+#include <vector>
+
+namespace darknet
+{
+    using namespace dlib;
+
+    enum class fused_activation
+    {
+        leaky,
+        mish,
+        sigmoid
+    };
+
+    enum class fused_precision
+    {
+        f32,
+        f16,
+        bf16,
+        int8
+    };
+
+    inline bool is_half_precision(const fused_precision precision)
+    {
+        return precision == fused_precision::f16 or precision == fused_precision::bf16;
+    }
+
+    inline const char* to_string(const fused_precision precision)
+    {
+        switch (precision)
+        {
+        case fused_precision::f32:
+            return "f32";
+        case fused_precision::f16:
+            return "f16";
+        case fused_precision::bf16:
+            return "bf16";
+        case fused_precision::int8:
+            return "int8";
+        }
+        return "unknown";
+    }
+
+    inline const char* to_string(const fused_activation act)
+    {
+        switch (act)
+        {
+        case fused_activation::leaky:
+            return "leaky";
+        case fused_activation::mish:
+            return "mish";
+        case fused_activation::sigmoid:
+            return "sigmoid";
+        }
+        return "unknown";
+    }
+
+    template <template <typename> class... TAGS> class route_;
+
+    template <typename T> struct is_route : std::false_type
+    {
+    };
+    template <template <typename> class... TAGS> struct is_route<route_<TAGS...>> : std::true_type
+    {
+    };
+
+    // true if the subnetwork given to a layer is a route_ layer
+    template <typename SUBNET, typename = void> struct reads_route : std::false_type
+    {
+    };
+    template <typename SUBNET>
+    using layer_details_of = std::decay_t<decltype(std::declval<const SUBNET&>().layer_details())>;
+    template <typename SUBNET>
+    struct reads_route<SUBNET, std::void_t<layer_details_of<SUBNET>>>
+        : is_route<layer_details_of<SUBNET>>
+    {
+    };
+
+    // An inference-only convolution with the batch normalization folded into its filters and
+    // biases, followed by an activation.  It replaces the con -> affine -> activation sequence
+    // of the *_infer networks: the biases and the activation are applied in a single pass over
+    // the output of the convolution, in place, so the intermediate feature maps of the affine
+    // and activation layers are never written.  The parameters have the same layout as those of
+    // con_: the filters followed by one bias per filter.
+    //
+    // The layer can also run in INT8 after post-training quantization: while calibrating, it
+    // records the largest magnitude of its input; quantize_int8() then quantizes each filter
+    // with its own scale and the input with the calibrated range, and the convolution runs as
+    // an integer GEMM whose output is rescaled, biased and activated in a single pass.
+    //
+    // In f16 or bf16, the filters are only kept in 16 bits, in memory and when serialized, and
+    // the parameter tensor only holds the biases.  They are widened into a scratch tensor shared
+    // by all the layers of the thread right before the convolution.
+    //
+    // On top of a route_ layer, the layer reads the tensors of the route itself, so their
+    // concatenation is never copied.  A 1x1 convolution of a concatenation is the sum of the
+    // products of each input by its slice of the filters, and the inputs smaller than the
+    // largest one, which the network would upsample before the concatenation, are multiplied
+    // at their own size and only the product is resized: both are linear and the convolution
+    // works on each pixel alone, so the result is the same, up to the rounding.  The other
+    // convolutions, and the INT8 and calibration passes, gather the concatenation first.
+    template <
+        long _num_filters,
+        long _nr,
+        long _nc,
+        int _stride_y,
+        int _stride_x,
+        int _padding_y,
+        int _padding_x,
+        fused_activation _act>
+    class fused_con_
+    {
+        static_assert(_num_filters > 0, "The number of filters must be > 0");
+        static_assert(_nr > 0 and _nc > 0, "The filter size must be > 0");
+        static_assert(_stride_y > 0 and _stride_x > 0, "The filter stride must be > 0");
+
+        public:
+        fused_con_() = default;
+
+        // the convolution object is stateless and can't be copied, so it is left out
+        fused_con_(const fused_con_& item)
+            : params(item.params),
+              filters(item.filters),
+              biases(item.biases),
+              num_filters_(item.num_filters_),
+              precision(item.precision),
+              calibrating(item.calibrating),
+              input_range(item.input_range),
+              qfilters(item.qfilters),
+              qscales(item.qscales),
+              half_filters(item.half_filters)
+        {
+        }
+
+        fused_con_& operator=(const fused_con_& item)
+        {
+            if (this != &item)
+            {
+                params = item.params;
+                filters = item.filters;
+                biases = item.biases;
+                num_filters_ = item.num_filters_;
+                precision = item.precision;
+                calibrating = item.calibrating;
+                input_range = item.input_range;
+                qfilters = item.qfilters;
+                qscales = item.qscales;
+                half_filters = item.half_filters;
+            }
+            return *this;
+        }
+
+        long num_filters() const { return num_filters_; }
+        long nr() const { return _nr; }
+        long nc() const { return _nc; }
+        long stride_y() const { return _stride_y; }
+        long stride_x() const { return _stride_x; }
+        long padding_y() const { return _padding_y; }
+        long padding_x() const { return _padding_x; }
+        fused_activation activation() const { return _act; }
+
+        // the activation of the layer applied to a single value
+        static float activate(const float x)
+        {
+            switch (_act)
+            {
+            case fused_activation::leaky:
+                return x > 0 ? x : leaky_alpha * x;
+            case fused_activation::mish:
+                return mish_exact(x);
+            case fused_activation::sigmoid:
+                return 1 / (1 + std::exp(-x));
+            }
+            return x;
+        }
+
+        void set_num_filters(const long num)
+        {
+            DLIB_CASSERT(num > 0);
+            if (num != num_filters_)
+            {
+                DLIB_CASSERT(
+                    get_layer_params().size() == 0,
+                    "You can't change the number of filters in fused_con_ if the parameter "
+                    "tensor has already been allocated.");
+                num_filters_ = num;
+            }
+        }
+
+        // number of input channels, only valid after setup()
+        long num_inputs() const { return filters.k(); }
+
+        // the filters are only available in f32 and int8
+        alias_tensor_instance get_filters()
+        {
+            DLIB_CASSERT(not is_half_precision(precision));
+            return filters(params, 0);
+        }
+        alias_tensor_const_instance get_filters() const
+        {
+            DLIB_CASSERT(not is_half_precision(precision));
+            return filters(params, 0);
+        }
+        alias_tensor_instance get_biases() { return biases(params, biases_offset()); }
+        alias_tensor_const_instance get_biases() const
+        {
+            return biases(params, biases_offset());
+        }
+
+        fused_precision get_precision() const { return precision; }
+
+        // the filters in f16 or bf16, empty in the other precisions
+        const std::vector<uint16_t>& get_half_filters() const { return half_filters; }
+        std::vector<uint16_t>& get_half_filters() { return half_filters; }
+
+        void set_precision(const fused_precision p)
+        {
+            if (p == precision)
+                return;
+            if (p == fused_precision::int8 and qfilters.empty())
+                throw std::runtime_error("fused_con_: quantize_int8() must be called first");
+            if (is_half_precision(precision))
+                widen_filters();
+            if (is_half_precision(p))
+                narrow_filters(p);
+            precision = p;
+        }
+
+        // While calibrating, the layer runs in f32 and records the range of its inputs.
+        void set_calibrating(const bool value)
+        {
+            if (value and not calibrating)
+                input_range = 0;
+            calibrating = value;
+        }
+
+        float get_input_range() const { return input_range; }
+
+        void quantize_int8()
+        {
+            if (not (input_range > 0))
+                throw std::runtime_error("fused_con_: the layer must be calibrated first");
+            if (is_half_precision(precision))
+                throw std::runtime_error("fused_con_: only f32 filters can be quantized");
+            const auto f = get_filters();
+            quantize_rows(f.host(), num_filters_, f.size() / num_filters_, qfilters, qscales);
+            precision = fused_precision::int8;
+        }
+
+        template <typename SUBNET> void setup(const SUBNET& sub)
+        {
+            const long num_inputs = _nr * _nc * sub.get_output().k();
+            const long num_outputs = num_filters_;
+            params.set_size(num_inputs * num_filters_ + num_filters_);
+            dlib::rand rnd(std::rand());
+            randomize_parameters(params, num_inputs + num_outputs, rnd);
+            filters = alias_tensor(num_filters_, sub.get_output().k(), _nr, _nc);
+            biases = alias_tensor(1, num_filters_);
+            get_biases() = 0;
+        }
+
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            if constexpr (reads_route<SUBNET>::value)
+            {
+                std::vector<const tensor*> inputs;
+                layer_details_of<SUBNET>::get_inputs(sub.subnet(), inputs);
+                const bool pointwise = _nr == 1 and _nc == 1 and _stride_y == 1 and
+                                       _stride_x == 1 and _padding_y == 0 and _padding_x == 0;
+                if (pointwise and precision != fused_precision::int8 and not calibrating)
+                {
+                    with_filters([&](const tensor& f) { convolve_route(inputs, f, output); });
+                    return;
+                }
+                thread_local resizable_tensor concatenation;
+                gather_route(inputs, concatenation);
+                forward_input(concatenation, output);
+            }
+            else
+            {
+                forward_input(sub.get_output(), output);
+            }
+        }
+
+        template <typename SUBNET> void backward(const tensor&, SUBNET&, tensor&)
+        {
+            throw std::runtime_error("fused_con_ can only be used for inference");
+        }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const fused_con_& item, std::ostream& out)
+        {
+            serialize("fused_con_3", out);
+            serialize(item.params, out);
+            serialize(item.num_filters_, out);
+            serialize(_nr, out);
+            serialize(_nc, out);
+            serialize(_stride_y, out);
+            serialize(_stride_x, out);
+            serialize(_padding_y, out);
+            serialize(_padding_x, out);
+            serialize(static_cast<int>(_act), out);
+            serialize(item.filters, out);
+            serialize(item.biases, out);
+            serialize(static_cast<int>(item.precision), out);
+            serialize(item.input_range, out);
+            serialize(item.qfilters, out);
+            serialize(item.qscales, out);
+            serialize(item.half_filters, out);
+        }
+
+        friend void deserialize(fused_con_& item, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "fused_con_" and version != "fused_con_2" and version != "fused_con_3")
+                throw serialization_error(
+                    "Unexpected version '" + version +
+                    "' found while deserializing darknet::fused_con_.");
+            long nr, nc;
+            int stride_y, stride_x, padding_y, padding_x, act;
+            deserialize(item.params, in);
+            deserialize(item.num_filters_, in);
+            deserialize(nr, in);
+            deserialize(nc, in);
+            deserialize(stride_y, in);
+            deserialize(stride_x, in);
+            deserialize(padding_y, in);
+            deserialize(padding_x, in);
+            deserialize(act, in);
+            deserialize(item.filters, in);
+            deserialize(item.biases, in);
+            item.precision = fused_precision::f32;
+            item.input_range = 0;
+            item.qfilters.clear();
+            item.qscales.clear();
+            item.half_filters.clear();
+            if (version != "fused_con_")
+            {
+                int precision;
+                deserialize(precision, in);
+                deserialize(item.input_range, in);
+                deserialize(item.qfilters, in);
+                deserialize(item.qscales, in);
+                item.precision = static_cast<fused_precision>(precision);
+            }
+            if (version == "fused_con_3")
+                deserialize(item.half_filters, in);
+            if (nr != _nr or nc != _nc or stride_y != _stride_y or stride_x != _stride_x or
+                padding_y != _padding_y or padding_x != _padding_x or
+                act != static_cast<int>(_act))
+                throw serialization_error(
+                    "Wrong filter shape or activation found while deserializing "
+                    "darknet::fused_con_");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const fused_con_& item)
+        {
+            out << "fused_con\t ("
+                << "num_filters=" << item.num_filters_ << ", nr=" << _nr << ", nc=" << _nc
+                << ", stride_y=" << _stride_y << ", stride_x=" << _stride_x
+                << ", padding_y=" << _padding_y << ", padding_x=" << _padding_x
+                << ", act=" << to_string(_act) << ", precision=" << to_string(item.precision)
+                << ")";
+            return out;
+        }
+
+        friend void to_xml(const fused_con_& item, std::ostream& out)
+        {
+            out << "<fused_con"
+                << " num_filters='" << item.num_filters_ << "'"
+                << " nr='" << _nr << "'"
+                << " nc='" << _nc << "'"
+                << " stride_y='" << _stride_y << "'"
+                << " stride_x='" << _stride_x << "'"
+                << " padding_y='" << _padding_y << "'"
+                << " padding_x='" << _padding_x << "'"
+                << " act='" << to_string(_act) << "'"
+                << " precision='" << to_string(item.precision) << "'>\n";
+            out << mat(item.params);
+            out << "</fused_con>\n";
+        }
+
+        private:
+        void forward_input(const tensor& input, resizable_tensor& output)
+        {
+            if (precision == fused_precision::int8)
+            {
+                forward_int8(input, output);
+                return;
+            }
+            if (calibrating)
+                record_input_range(input);
+            with_filters([&](const tensor& f) { convolve(input, f, output); });
+        }
+
+        // calls f with the filters in f32
+        template <typename F> void with_filters(F&& f)
+        {
+            if (is_half_precision(precision))
+            {
+                thread_local resizable_tensor wide_filters;
+                wide_filters.set_size(
+                    filters.num_samples(),
+                    filters.k(),
+                    filters.nr(),
+                    filters.nc());
+                if (precision == fused_precision::f16)
+                    widen_from_f16(half_filters.data(), wide_filters.host(), half_filters.size());
+                else
+                    widen_from_bf16(half_filters.data(), wide_filters.host(), half_filters.size());
+                f(wide_filters);
+                return;
+            }
+            f(get_filters());
+        }
+
+        // the size of the concatenation of the inputs of a route, the one of the largest input
+        static void get_route_size(const std::vector<const tensor*>& inputs, long& nr, long& nc)
+        {
+            nr = nc = 0;
+            for (const auto* t : inputs)
+            {
+                DLIB_CASSERT(t->num_samples() == inputs.front()->num_samples());
+                nr = std::max(nr, t->nr());
+                nc = std::max(nc, t->nc());
+            }
+        }
+
+        // the concatenation of the inputs of a route, with the smaller ones upsampled
+        static void gather_route(const std::vector<const tensor*>& inputs, resizable_tensor& out)
+        {
+            long nr, nc, k = 0;
+            get_route_size(inputs, nr, nc);
+            for (const auto* t : inputs)
+                k += t->k();
+            out.set_size(inputs.front()->num_samples(), k, nr, nc);
+            thread_local resizable_tensor upsampled;
+            long offset = 0;
+            for (const auto* t : inputs)
+            {
+                if (t->nr() == nr and t->nc() == nc)
+                {
+                    tt::copy_tensor(false, out, offset, *t, 0, t->k());
+                }
+                else
+                {
+                    upsampled.set_size(t->num_samples(), t->k(), nr, nc);
+                    tt::resize_bilinear(upsampled, *t);
+                    tt::copy_tensor(false, out, offset, upsampled, 0, t->k());
+                }
+                offset += t->k();
+            }
+        }
+
+        void convolve_route(
+            const std::vector<const tensor*>& inputs,
+            const tensor& f,
+            resizable_tensor& output)
+        {
+            long nr, nc;
+            get_route_size(inputs, nr, nc);
+            const long num_samples = inputs.front()->num_samples();
+            output.set_size(num_samples, num_filters_, nr, nc);
+            thread_local resizable_tensor slice, product, upsampled;
+            // resize_bilinear overwrites its output, so the products to resize come first
+            bool first = true;
+            for (const bool resized : {true, false})
+            {
+                long offset = 0;
+                for (const auto* t : inputs)
+                {
+                    offset += t->k();
+                    if ((t->nr() != nr or t->nc() != nc) != resized)
+                        continue;
+                    slice.set_size(num_filters_, t->k());
+                    tt::copy_tensor(false, slice, 0, f, offset - t->k(), t->k());
+                    if (resized)
+                    {
+                        product.set_size(num_samples, num_filters_, t->nr(), t->nc());
+                        multiply(slice, *t, product, 0);
+                        if (first)
+                        {
+                            tt::resize_bilinear(output, product);
+                        }
+                        else
+                        {
+                            upsampled.copy_size(output);
+                            tt::resize_bilinear(upsampled, product);
+                            tt::add(1, output, 1, upsampled);
+                        }
+                    }
+                    else
+                    {
+                        multiply(slice, *t, output, first ? 0 : 1);
+                    }
+                    first = false;
+                }
+            }
+            add_bias_and_activate(output);
+        }
+
+        // output = beta * output + f * input for each sample, with the filters as a matrix of
+        // one row per filter and the input as a matrix of one row per channel
+        static void multiply(const tensor& f, const tensor& input, tensor& output, float beta)
+        {
+            const long plane_size = input.nr() * input.nc();
+            const alias_tensor in_sample(input.k(), plane_size);
+            const alias_tensor out_sample(output.k(), plane_size);
+            for (long n = 0; n < input.num_samples(); ++n)
+            {
+                auto out = out_sample(output, n * out_sample.size());
+                tt::gemm(beta, out, 1, f, false, in_sample(input, n * in_sample.size()), false);
+            }
+        }
+
+        void add_bias_and_activate(tensor& output) const
+        {
+#ifdef DLIB_USE_CUDA
+            const auto b_alias = get_biases();
+            tt::add(1, output, 1, b_alias);
+            switch (_act)
+            {
+            case fused_activation::leaky:
+                tt::leaky_relu(output, output, leaky_alpha);
+                break;
+            case fused_activation::mish:
+                tt::mish(output, output);
+                break;
+            case fused_activation::sigmoid:
+                tt::sigmoid(output, output);
+                break;
+            }
+#else
+            const long plane_size = output.nr() * output.nc();
+            const auto b_alias = get_biases();
+            const float* b = b_alias.host();
+            float* out = output.host();
+            for (long n = 0; n < output.num_samples(); ++n)
+            {
+                for (long k = 0; k < output.k(); ++k, out += plane_size)
+                {
+                    const float bias = b[k];
+                    if (_act == fused_activation::mish)
+                    {
+                        for (long i = 0; i < plane_size; ++i)
+                            out[i] += bias;
+                        apply_mish(out, plane_size);
+                    }
+                    else
+                    {
+                        for (long i = 0; i < plane_size; ++i)
+                            out[i] = activate(out[i] + bias);
+                    }
+                }
+            }
+#endif
+        }
+
+        long biases_offset() const { return is_half_precision(precision) ? 0 : filters.size(); }
+
+        void convolve(const tensor& input, const tensor& f, resizable_tensor& output)
+        {
+            conv.setup(input, f, _stride_y, _stride_x, _padding_y, _padding_x);
+            conv(false, output, input, f);
+            add_bias_and_activate(output);
+        }
+
+        // keeps the filters in 16 bits and shrinks the parameters to the biases
+        void narrow_filters(const fused_precision p)
+        {
+            const auto f = get_filters();
+            half_filters.resize(f.size());
+            if (p == fused_precision::f16)
+                narrow_to_f16(f.host(), half_filters.data(), f.size());
+            else
+                narrow_to_bf16(f.host(), half_filters.data(), f.size());
+            const matrix<float> b = mat(get_biases());
+            params = b;
+        }
+
+        void widen_filters()
+        {
+            const matrix<float> b = mat(get_biases());
+            params.set_size(filters.size() + biases.size());
+            if (precision == fused_precision::f16)
+                widen_from_f16(half_filters.data(), params.host(), half_filters.size());
+            else
+                widen_from_bf16(half_filters.data(), params.host(), half_filters.size());
+            half_filters.clear();
+            half_filters.shrink_to_fit();
+            biases(params, filters.size()) = b;
+        }
+
+        void record_input_range(const tensor& input)
+        {
+            const float* in = input.host();
+            float range = input_range;
+            for (size_t i = 0; i < input.size(); ++i)
+                range = std::max(range, std::abs(in[i]));
+            input_range = range;
+        }
+
+        void forward_int8(const tensor& input, resizable_tensor& output)
+        {
+            const long out_nr = 1 + (input.nr() + 2 * _padding_y - _nr) / _stride_y;
+            const long out_nc = 1 + (input.nc() + 2 * _padding_x - _nc) / _stride_x;
+            output.set_size(input.num_samples(), num_filters_, out_nr, out_nc);
+            const long plane_size = out_nr * out_nc;
+            const long in_size = input.k() * input.nr() * input.nc();
+            const long kp = pad_quantized_k(input.k() * _nr * _nc);
+            DLIB_CASSERT(static_cast<long>(qfilters.size()) == num_filters_ * kp);
+            const float inv_scale = 127 / input_range;
+            const float in_scale = input_range / 127;
+            const auto b_alias = get_biases();
+            const float* b = b_alias.host();
+            qinput.resize(in_size);
+            // Each chunk of output pixels is processed by one thread: its receptive fields are
+            // gathered into a small buffer that stays in cache while all the filters go over it.
+            const long chunk_size = 64;
+            const long num_chunks = (plane_size + chunk_size - 1) / chunk_size;
+            for (long n = 0; n < input.num_samples(); ++n)
+            {
+                const float* in = input.host() + n * in_size;
+                for (long i = 0; i < in_size; ++i)
+                    qinput[i] = quantize_value(in[i], inv_scale);
+                float* out = output.host() + n * num_filters_ * plane_size;
+                parallel_for(
+                    0,
+                    num_chunks,
+                    [&](const long chunk)
+                    {
+                        thread_local std::vector<int16_t> cols;
+                        thread_local std::vector<int32_t> acc;
+                        const long p_begin = chunk * chunk_size;
+                        const long p_end = std::min(p_begin + chunk_size, plane_size);
+                        const long num_cols = p_end - p_begin;
+                        cols.resize(num_cols * kp);
+                        acc.resize(num_filters_ * num_cols);
+                        quantized_im2col(
+                            qinput.data(),
+                            input.k(),
+                            input.nr(),
+                            input.nc(),
+                            _nr,
+                            _nc,
+                            _stride_y,
+                            _stride_x,
+                            _padding_y,
+                            _padding_x,
+                            out_nc,
+                            p_begin,
+                            p_end,
+                            cols.data());
+                        quantized_gemm(
+                            qfilters.data(),
+                            num_filters_,
+                            cols.data(),
+                            num_cols,
+                            kp,
+                            acc.data(),
+                            num_cols);
+                        for (long k = 0; k < num_filters_; ++k)
+                        {
+                            const float scale = qscales[k] * in_scale;
+                            const int32_t* a = acc.data() + k * num_cols;
+                            float* o = out + k * plane_size + p_begin;
+                            if (_act == fused_activation::mish)
+                            {
+                                for (long i = 0; i < num_cols; ++i)
+                                    o[i] = a[i] * scale + b[k];
+                                apply_mish(o, num_cols);
+                            }
+                            else
+                            {
+                                for (long i = 0; i < num_cols; ++i)
+                                    o[i] = activate(a[i] * scale + b[k]);
+                            }
+                        }
+                    });
+            }
+        }
+
+        static constexpr float leaky_alpha = 0.1f;
+        resizable_tensor params;
+        alias_tensor filters, biases;
+        long num_filters_ = _num_filters;
+        fused_precision precision = fused_precision::f32;
+        bool calibrating = false;
+        float input_range = 0;
+        std::vector<int16_t> qfilters;
+        std::vector<float> qscales;
+        std::vector<uint16_t> half_filters;
+        std::vector<int16_t> qinput;
+        tt::tensor_conv conv;
+    };
+
+    template <
+        long num_filters,
+        long nr,
+        long nc,
+        int stride_y,
+        int stride_x,
+        fused_activation act,
+        typename SUBNET>
+    using fused_con = add_layer<
+        fused_con_<num_filters, nr, nc, stride_y, stride_x, nr / 2, nc / 2, act>,
+        SUBNET>;
+
+    template <typename T> struct is_fused_con : std::false_type
+    {
+    };
+
+    template <
+        long nf,
+        long nr,
+        long nc,
+        int sy,
+        int sx,
+        int py,
+        int px,
+        fused_activation act>
+    struct is_fused_con<fused_con_<nf, nr, nc, sy, sx, py, px, act>> : std::true_type
+    {
+    };
+
+    // calls f(l) on every fused_con_ layer l of the network
+    template <typename net_type, typename visitor>
+    void visit_fused_con_layers(net_type& net, visitor&& f)
+    {
+        visit_computational_layers(
+            net,
+            [&f](auto& l)
+            {
+                if constexpr (is_fused_con<std::decay_t<decltype(l)>>::value)
+                    f(l);
+            });
+    }
+
+    // Post-training quantization of the fused layers of a network: enable the calibration, run
+    // representative images through the network, disable it and quantize the layers.
+    template <typename net_type> void set_calibrating(net_type& net, const bool value)
+    {
+        visit_fused_con_layers(net, [value](auto& l) { l.set_calibrating(value); });
+    }
+
+    template <typename net_type> size_t quantize_int8(net_type& net)
+    {
+        size_t num_layers = 0;
+        visit_fused_con_layers(
+            net,
+            [&num_layers](auto& l)
+            {
+                l.quantize_int8();
+                ++num_layers;
+            });
+        return num_layers;
+    }
+
+    template <typename net_type> void set_precision(net_type& net, const fused_precision precision)
+    {
+        visit_fused_con_layers(net, [precision](auto& l) { l.set_precision(precision); });
+    }
+
+    // Keeps the channels of group _group_id of its input, split in _groups equal groups, like
+    // the route layer of darknet with the groups and group_id options.  The CSP blocks of
+    // yolov4-tiny use it to feed half of the channels of a convolution to the next ones.
+    template <long _groups, long _group_id> class route_group_
+    {
+        static_assert(_groups > 0, "The number of groups must be > 0");
+        static_assert(
+            _group_id >= 0 and _group_id < _groups,
+            "The group_id must be in [0, groups)");
+
+        public:
+        route_group_() = default;
+
+        long groups() const { return _groups; }
+        long group_id() const { return _group_id; }
+
+        template <typename SUBNET> void setup(const SUBNET& sub)
+        {
+            DLIB_CASSERT(
+                sub.get_output().k() % _groups == 0,
+                "The number of channels of the input of route_group_ must be a multiple of the "
+                "number of groups");
+        }
+
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            const tensor& input = sub.get_output();
+            const long k = input.k() / _groups;
+            output.set_size(input.num_samples(), k, input.nr(), input.nc());
+            tt::copy_tensor(false, output, 0, input, _group_id * k, k);
+        }
+
+        template <typename SUBNET>
+        void backward(const tensor& gradient_input, SUBNET& sub, tensor&)
+        {
+            const long k = gradient_input.k();
+            tt::copy_tensor(true, sub.get_gradient_input(), _group_id * k, gradient_input, 0, k);
+        }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const route_group_&, std::ostream& out)
+        {
+            serialize("route_group_", out);
+            serialize(_groups, out);
+            serialize(_group_id, out);
+        }
+
+        friend void deserialize(route_group_&, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "route_group_")
+                throw serialization_error(
+                    "Unexpected version '" + version +
+                    "' found while deserializing darknet::route_group_.");
+            long groups, group_id;
+            deserialize(groups, in);
+            deserialize(group_id, in);
+            if (groups != _groups or group_id != _group_id)
+                throw serialization_error(
+                    "Wrong groups or group_id found while deserializing darknet::route_group_");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const route_group_&)
+        {
+            out << "route_group\t (groups=" << _groups << ", group_id=" << _group_id << ")";
+            return out;
+        }
+
+        friend void to_xml(const route_group_&, std::ostream& out)
+        {
+            out << "<route_group groups='" << _groups << "' group_id='" << _group_id << "'/>\n";
+        }
+
+        private:
+        resizable_tensor params;
+    };
+
+    template <long groups, long group_id, typename SUBNET>
+    using route_group = add_layer<route_group_<groups, group_id>, SUBNET>;
+
+    // The concatenation along the channels of the tensors tagged with TAGS, for the fused_con_
+    // layer above it, which reads them itself: the output of the layer only has the number of
+    // channels of the concatenation and no pixels, so the concatenation is never written.  The
+    // tensors smaller than the largest one are upsampled to its size by fused_con_, which lets
+    // the route replace the upsample_ layer of a branch as well.  The *_fused networks use it
+    // for the concatenations read by 1x1 convolutions, see routeblock in darknet.h.
+    template <template <typename> class... TAGS> class route_
+    {
+        static_assert(sizeof...(TAGS) > 0, "A route needs at least one tag");
+
+        public:
+        route_() = default;
+
+        template <typename SUBNET>
+        static void get_inputs(const SUBNET& sub, std::vector<const tensor*>& inputs)
+        {
+            (inputs.push_back(&layer<TAGS>(sub).get_output()), ...);
+        }
+
+        template <typename SUBNET> void setup(const SUBNET&) {}
+
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            std::vector<const tensor*> inputs;
+            get_inputs(sub, inputs);
+            long k = 0;
+            for (const auto* t : inputs)
+                k += t->k();
+            output.set_size(inputs.front()->num_samples(), k, 0, 0);
+        }
+
+        template <typename SUBNET> void backward(const tensor&, SUBNET&, tensor&)
+        {
+            throw std::runtime_error("route_ can only be used for inference");
+        }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const route_&, std::ostream& out)
+        {
+            serialize("route_", out);
+            serialize(static_cast<long>(sizeof...(TAGS)), out);
+        }
+
+        friend void deserialize(route_&, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "route_")
+                throw serialization_error(
+                    "Unexpected version '" + version +
+                    "' found while deserializing darknet::route_.");
+            long num_tags;
+            deserialize(num_tags, in);
+            if (num_tags != static_cast<long>(sizeof...(TAGS)))
+                throw serialization_error(
+                    "Wrong number of tags found while deserializing darknet::route_");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const route_&)
+        {
+            out << "route\t (tags=" << sizeof...(TAGS) << ")";
+            return out;
+        }
+
+        friend void to_xml(const route_&, std::ostream& out)
+        {
+            out << "<route tags='" << sizeof...(TAGS) << "'/>\n";
+        }
+
+        private:
+        resizable_tensor params;
+    };
+
+    template <template <typename> class TAG1, template <typename> class TAG2, typename SUBNET>
+    using route2 = add_layer<route_<TAG1, TAG2>, SUBNET>;
+
+    // Max pooling with a stride of 1 that keeps the size of its input, like the maxpool layer of
+    // darknet with a stride of 1: the window starts at each pixel and is clipped by the bottom
+    // and right borders.  dlib's max_pool pads every border, which gives one more row and column
+    // and shifts the output by a pixel.  yolov3-tiny uses it before its last convolutions.
+    template <long _size> class same_max_pool_
+    {
+        static_assert(_size > 0, "The pooling size must be > 0");
+
+        public:
+        same_max_pool_() = default;
+
+        long size() const { return _size; }
+
+        template <typename SUBNET> void setup(const SUBNET&) {}
+
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            const tensor& input = sub.get_output();
+            output.copy_size(input);
+            const long nr = input.nr();
+            const long nc = input.nc();
+            const float* in = input.host();
+            float* out = output.host();
+            for (long p = 0; p < input.num_samples() * input.k(); ++p)
+            {
+                for (long r = 0; r < nr; ++r)
+                {
+                    for (long c = 0; c < nc; ++c)
+                        out[r * nc + c] = in[argmax(in, nr, nc, r, c)];
+                }
+                in += nr * nc;
+                out += nr * nc;
+            }
+        }
+
+        // each output passes its gradient to the input that was the maximum of its window
+        template <typename SUBNET>
+        void backward(const tensor& gradient_input, SUBNET& sub, tensor&)
+        {
+            const tensor& input = sub.get_output();
+            const long nr = input.nr();
+            const long nc = input.nc();
+            const float* in = input.host();
+            const float* g = gradient_input.host();
+            float* grad = sub.get_gradient_input().host();
+            for (long p = 0; p < input.num_samples() * input.k(); ++p)
+            {
+                for (long r = 0; r < nr; ++r)
+                {
+                    for (long c = 0; c < nc; ++c)
+                        grad[argmax(in, nr, nc, r, c)] += g[r * nc + c];
+                }
+                in += nr * nc;
+                g += nr * nc;
+                grad += nr * nc;
+            }
+        }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const same_max_pool_&, std::ostream& out)
+        {
+            serialize("same_max_pool_", out);
+            serialize(_size, out);
+        }
+
+        friend void deserialize(same_max_pool_&, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "same_max_pool_")
+                throw serialization_error(
+                    "Unexpected version '" + version +
+                    "' found while deserializing darknet::same_max_pool_.");
+            long size;
+            deserialize(size, in);
+            if (size != _size)
+                throw serialization_error(
+                    "Wrong size found while deserializing darknet::same_max_pool_");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const same_max_pool_&)
+        {
+            out << "same_max_pool\t (size=" << _size << ")";
+            return out;
+        }
+
+        friend void to_xml(const same_max_pool_&, std::ostream& out)
+        {
+            out << "<same_max_pool size='" << _size << "'/>\n";
+        }
+
+        private:
+        // index in the plane of the largest input of the window starting at (r, c)
+        static long argmax(
+            const float* in,
+            const long nr,
+            const long nc,
+            const long r,
+            const long c)
+        {
+            long best = r * nc + c;
+            for (long y = r; y < std::min(r + _size, nr); ++y)
+            {
+                for (long x = c; x < std::min(c + _size, nc); ++x)
+                {
+                    if (in[y * nc + x] > in[best])
+                        best = y * nc + x;
+                }
+            }
+            return best;
+        }
+
+        resizable_tensor params;
+    };
+
+    template <long size, typename SUBNET>
+    using same_max_pool = add_layer<same_max_pool_<size>, SUBNET>;
+
+    // The max pools of the spatial pyramid pooling of YOLOv4 as a cascade, as in the SPPF block
+    // of YOLOv5: a max pool with a window of _size and a stride of 1, with the input clipped at
+    // the borders like dlib's max_pool, is the max pool with a window of _step of the one with a
+    // window of _size - _step + 1.  With a _size larger than _step, the layer reads the output
+    // of that smaller pool below the skip layer under it, as in the spp blocks, where each pool
+    // follows a skip back to the input of the block, so it gives the output of those blocks bit
+    // for bit.  Each pool is separable too, a max over the rows followed by a max over the
+    // columns, so the three pools of a spp block cost 6 * (_step - 1) comparisons per pixel
+    // instead of 275 with a _step of 5.  It is serialized as the max_pool_ it replaces, so the
+    // networks saved with the spp blocks of max pools still load.
+    template <long _size, long _step> class cascaded_max_pool_
+    {
+        static_assert(_step > 1 and _step % 2 == 1, "The pooling step must be odd and > 1");
+        static_assert(
+            _size >= _step and (_size - _step) % (_step - 1) == 0,
+            "The pooling size must be a cascade of pools of the step");
+
+        public:
+        cascaded_max_pool_() = default;
+
+        long size() const { return _size; }
+
+        template <typename SUBNET> void setup(const SUBNET&) {}
+
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            const tensor& input = pooled_input(sub);
+            if (not have_same_dimensions(input, sub.get_output()))
+                throw std::runtime_error(
+                    "cascaded_max_pool_: the smaller pool must be below the skip layer");
+            output.copy_size(input);
+#ifdef DLIB_USE_CUDA
+            tt::pooling mp;
+            mp.setup_max_pooling(_step, _step, 1, 1, _step / 2, _step / 2);
+            mp(output, input);
+#else
+            const long plane_size = input.nr() * input.nc();
+            rows.resize(plane_size);
+            const float* in = input.host();
+            float* out = output.host();
+            for (long i = 0; i < input.num_samples() * input.k(); ++i)
+                pool(in + i * plane_size, input.nr(), input.nc(), out + i * plane_size);
+#endif
+        }
+
+        // each output passes its gradient to the input of the block that was the maximum of its
+        // window
+        template <typename SUBNET>
+        void backward(const tensor& gradient_input, SUBNET& sub, tensor&)
+        {
+            const tensor& input = sub.get_output();
+            const long nr = input.nr();
+            const long nc = input.nc();
+            const long plane_size = nr * nc;
+            const float* in = input.host();
+            const float* g = gradient_input.host();
+            float* grad = sub.get_gradient_input().host();
+            for (long i = 0; i < input.num_samples() * input.k(); ++i)
+            {
+                const float* ip = in + i * plane_size;
+                const float* gp = g + i * plane_size;
+                float* dp = grad + i * plane_size;
+                for (long r = 0; r < nr; ++r)
+                {
+                    for (long c = 0; c < nc; ++c)
+                        dp[argmax(ip, nr, nc, r, c, _size / 2)] += gp[r * nc + c];
+                }
+            }
+        }
+
+        // the output of the pool with a window of _size - _step + 1, or the input of the block
+        template <typename SUBNET> static const tensor& pooled_input(const SUBNET& sub)
+        {
+            if constexpr (_size == _step)
+                return sub.get_output();
+            else
+                return sub.subnet().get_output();
+        }
+
+        inline dpoint map_input_to_output(const dpoint& p) const { return p; }
+        inline dpoint map_output_to_input(const dpoint& p) const { return p; }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const cascaded_max_pool_&, std::ostream& out)
+        {
+            serialize(max_pool_<_size, _size, 1, 1>(), out);
+        }
+
+        friend void deserialize(cascaded_max_pool_&, std::istream& in)
+        {
+            max_pool_<_size, _size, 1, 1> pool;
+            deserialize(pool, in);
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const cascaded_max_pool_&)
+        {
+            out << "cascaded_max_pool\t (size=" << _size << ", step=" << _step << ")";
+            return out;
+        }
+
+        friend void to_xml(const cascaded_max_pool_&, std::ostream& out)
+        {
+            out << "<cascaded_max_pool size='" << _size << "' step='" << _step << "'/>\n";
+        }
+
+        private:
+        // max pooling of a plane with a window of _step centered on each pixel, a max over the
+        // rows followed by a max over the columns, which the compiler vectorizes
+        void pool(const float* in, const long nr, const long nc, float* out)
+        {
+            constexpr long radius = _step / 2;
+            const auto clipped = [&](const float* row, const long c)
+            {
+                float m = row[c];
+                for (long x = std::max(0l, c - radius); x < std::min(nc, c + radius + 1); ++x)
+                    m = std::max(m, row[x]);
+                return m;
+            };
+            float* tmp = rows.data();
+            for (long r = 0; r < nr; ++r, in += nc, tmp += nc)
+            {
+                long c = 0;
+                for (; c < std::min(radius, nc); ++c)
+                    tmp[c] = clipped(in, c);
+                for (; c < nc - radius; ++c)
+                {
+                    float m = in[c - radius];
+                    for (long i = 1; i < _step; ++i)
+                        m = std::max(m, in[c - radius + i]);
+                    tmp[c] = m;
+                }
+                for (; c < nc; ++c)
+                    tmp[c] = clipped(in, c);
+            }
+            for (long r = 0; r < nr; ++r, out += nc)
+            {
+                const long r_end = std::min(nr, r + radius + 1);
+                const float* first = rows.data() + std::max(0l, r - radius) * nc;
+                std::copy(first, first + nc, out);
+                for (const float* t = first + nc; t < rows.data() + r_end * nc; t += nc)
+                {
+                    for (long c = 0; c < nc; ++c)
+                        out[c] = std::max(out[c], t[c]);
+                }
+            }
+        }
+
+        // index in the plane of the largest input of the window centered on (r, c)
+        static long argmax(
+            const float* in,
+            const long nr,
+            const long nc,
+            const long r,
+            const long c,
+            const long radius)
+        {
+            long best = r * nc + c;
+            for (long y = std::max(0l, r - radius); y < std::min(nr, r + radius + 1); ++y)
+            {
+                for (long x = std::max(0l, c - radius); x < std::min(nc, c + radius + 1); ++x)
+                {
+                    if (in[y * nc + x] > in[best])
+                        best = y * nc + x;
+                }
+            }
+            return best;
+        }
+
+        resizable_tensor params;
+        std::vector<float> rows;
+    };
+
+    template <long size, long step, typename SUBNET>
+    using cascaded_max_pool = add_layer<cascaded_max_pool_<size, step>, SUBNET>;
+
+    // Mish for inference on the CPU, with the vectorized kernel of mish.h.  It works in place, so
+    // it does not need a feature map of its own, unlike dlib's mish_ that keeps its input for the
+    // backward pass, which this layer does not have.  It converts from mish_, so the *_infer
+    // networks that use it are still assigned from their *_train networks, and it reads the
+    // networks serialized with mish_.  On the GPU it runs dlib's kernel.
+    class fast_mish_
+    {
+        public:
+        fast_mish_() = default;
+        fast_mish_(const mish_&) {}
+
+        template <typename SUBNET> void setup(const SUBNET&) {}
+
+        void forward_inplace(const tensor& input, tensor& output)
+        {
+#ifdef DLIB_USE_CUDA
+            tt::mish(output, input);
+#else
+            apply_mish(input.host(), output.host(), input.size());
+#endif
+        }
+
+        void backward_inplace(const tensor&, const tensor&, tensor&, tensor&)
+        {
+            throw std::runtime_error("fast_mish_ is for inference only, train with mish_");
+        }
+
+        inline dpoint map_input_to_output(const dpoint& p) const { return p; }
+        inline dpoint map_output_to_input(const dpoint& p) const { return p; }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const fast_mish_&, std::ostream& out)
+        {
+            serialize("fast_mish_", out);
+        }
+
+        friend void deserialize(fast_mish_&, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "fast_mish_" and version != "mish_")
+                throw serialization_error(
+                    "Unexpected version '" + version +
+                    "' found while deserializing darknet::fast_mish_.");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const fast_mish_&)
+        {
+            out << "fast_mish";
+            return out;
+        }
+
+        friend void to_xml(const fast_mish_&, std::ostream& out) { out << "<fast_mish/>\n"; }
+
+        private:
+        resizable_tensor params;
+    };
+
+    template <typename SUBNET> using fast_mish = add_layer<fast_mish_, SUBNET>;
+}  // namespace darknet
+
+#endif  // darknet_layers_h_INCLUDED
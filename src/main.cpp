@@ -1,11 +1,13 @@
-#include "darknet.h"
+#include "models.h"
+#include "motion_gate.h"
+#include "pipeline.h"
+#include "tracker.h"
 #include "ui_utils.h"
-#include "weights_visitor.h"
-#include "yolov4_sam_mish.h"
 
 #include <dlib/cmd_line_parser.h>
 #include <dlib/dir_nav.h>
 #include <dlib/image_io.h>
+#include <dlib/pipe.h>
 
 const static std::string exts{".jpg .JPG .jpeg .JPEG .png .PNG .gif .GIF"};
 
@@ -18,12 +20,34 @@ try
     parser.add_option("output", "path to output video file (.mkv extension) or directory", 1);
     parser.add_option("webcam", "index of webcam to use (default: 0)", 1);
     parser.add_option("names", "path to file with label names (one per line)", 1);
-    parser.add_option("img-size", "image size to process (default: 416)", 1);
+    parser.add_option("img-size", "image size to process, N or WxH (default: 416)", 1);
+    parser.add_option("batch-size", "images processed at once with --images (default: 1)", 1);
+    parser.add_option("parallel", "process --images with decode, inference and encode workers");
+    parser.add_option("decode-workers", "threads loading images with --parallel (default: 2)", 1);
+    parser.add_option("inference-workers", "detectors running with --parallel (default: 1)", 1);
+    parser.add_option("encode-workers", "threads saving images with --parallel (default: 2)", 1);
+    parser.add_option("format", "format of the images saved with --images: png or jpg", 1);
+    parser.add_option("tile", "detect on overlapping tiles of large images, --batch-size at once");
+    parser.add_option("tile-size", "size of the tiles in image pixels (default: --img-size)", 1);
+    parser.add_option("tile-overlap", "fraction of a tile shared with its neighbours (0.2)", 1);
+    parser.add_option("tile-full-frame", "also detect on the whole image to find large objects");
+    parser.add_option("plan-memory", "reuse the memory of the layer outputs during inference");
+    parser.add_option("letterbox", "keep the aspect ratio of the images and pad them");
     parser.add_option("conf-thresh", "confidence threshold (default: 0.25)", 1);
     parser.add_option("nms-thresh", "non-max suppression threshold (default: 0.45)", 1);
+    parser.add_option("nms-top-k", "max candidates per class before non-max suppression", 1);
+    parser.add_option("nms-diou", "use the distance IoU for non-max suppression");
+    parser.add_option("nms-agnostic", "suppress overlapping boxes regardless of their class");
+    parser.add_option("motion-thresh", "reuse detections below this motion (e.g. 0.005)", 1);
+    parser.add_option("motion-max-skip", "max frames reusing detections in a row (default: 0)", 1);
+    parser.add_option("track", "detect every N video frames and track the boxes in between", 1);
+    parser.add_option("track-flow", "correct the tracks with optical flow, detect when it fails");
+    parser.add_option("queue-depth", "frames buffered between the video stages (default: 2)", 1);
     parser.add_option("fps", "force frames per second (default: 30)", 1);
     parser.add_option("print", "print out the network architecture");
     parser.add_option("dnn", "path to dlib saved model", 1);
+    parser.add_option("model", get_model_names() + " (default: yolov4-sam-mish)", 1);
+    parser.add_option("fused", "the model given to --dnn was converted with --fused");
     parser.add_option("out-width", "set output width", 1);
     parser.set_group_name("Help Options");
     parser.add_option("h", "alias for --help");
@@ -40,13 +64,31 @@ try
     parser.check_incompatible_options("images", "input");
     parser.check_incompatible_options("images", "webcam");
     parser.check_incompatible_options("input", "webcam");
+    parser.check_incompatible_options("images", "motion-thresh");
+    parser.check_sub_option("motion-thresh", "motion-max-skip");
+    parser.check_incompatible_options("images", "track");
+    parser.check_incompatible_options("motion-thresh", "track");
+    parser.check_sub_option("track", "track-flow");
+    parser.check_sub_option("images", "parallel");
+    parser.check_sub_option("images", "format");
+    const char* parallel_options[] = {"decode-workers", "inference-workers", "encode-workers"};
+    parser.check_sub_options("parallel", parallel_options);
+    const char* tile_options[] = {"tile-size", "tile-overlap", "tile-full-frame"};
+    parser.check_sub_options("tile", tile_options);
 
     const std::string names_path = dlib::get_option(parser, "names", "");
     const int webcam_idx = dlib::get_option(parser, "webcam", 0);
     float fps = dlib::get_option(parser, "fps", 30);
-    const long img_size = dlib::get_option(parser, "img-size", 416);
+    const input_size img_size = parse_input_size(dlib::get_option(parser, "img-size", "416"));
+    const long batch_size = dlib::get_option(parser, "batch-size", 1);
+    if (batch_size < 1)
+    {
+        std::cout << "The batch size must be at least 1\n";
+        return EXIT_FAILURE;
+    }
     const float conf_thresh = dlib::get_option(parser, "conf-thresh", 0.25);
     const float nms_thresh = dlib::get_option(parser, "nms-thresh", 0.45);
+    const long queue_depth = std::max(dlib::get_option(parser, "queue-depth", 2), 1);
     const std::string dnn_path = dlib::get_option(parser, "dnn", "");
     const long out_width = dlib::get_option(parser, "out-width", 0);
     std::vector<std::string> labels;
@@ -65,8 +107,29 @@ try
     }
     std::cout << "found " << labels.size() << " classes\n";
 
-    yolov4_sam_mish yolo(dnn_path, names_path);
-    const auto label_to_color = get_color_map(labels);
+    const std::string model = dlib::get_option(parser, "model", "yolov4-sam-mish");
+    const bool fused = parser.option("fused").count() > 0;
+    const auto yolo_ptr = get_model(model).load(dnn_path, names_path, fused);
+    auto& yolo = *yolo_ptr;
+    yolo.set_letterbox(parser.option("letterbox").count() > 0);
+    yolo.set_memory_planning(parser.option("plan-memory").count() > 0);
+    nms_options nms_opts;
+    nms_opts.top_k = dlib::get_option(parser, "nms-top-k", 0);
+    nms_opts.iou_type = parser.option("nms-diou") ? DIOU : IOU;
+    nms_opts.class_agnostic = parser.option("nms-agnostic").count() > 0;
+    yolo.set_nms_options(nms_opts);
+    const bool tiled = parser.option("tile").count() > 0;
+    tiling_options tiling;
+    tiling.tile_size = dlib::get_option(parser, "tile-size", 0);
+    tiling.overlap = dlib::get_option(parser, "tile-overlap", 0.2);
+    tiling.full_frame = parser.option("tile-full-frame").count() > 0;
+    tiling.batch_size = dlib::get_option(parser, "batch-size", 4);
+    if (tiling.overlap < 0 or tiling.overlap >= 1)
+    {
+        std::cout << "The tile overlap must be in [0, 1)\n";
+        return EXIT_FAILURE;
+    }
+    const auto colors = get_color_map(labels);
     webcam_window win;
 
     if (parser.option("images"))
@@ -74,18 +137,218 @@ try
         const std::string images_dir = parser.option("images").argument();
         const std::string output_dir = dlib::get_option(parser, "output", "detections");
         dlib::create_directory(output_dir);
-        for (const auto& file :
-             dlib::get_files_in_directory_tree(images_dir, dlib::match_endings(exts)))
+        const std::string format = dlib::get_option(parser, "format", "png");
+        if (format != "png" and format != "jpg")
+        {
+            std::cout << "The output format must be png or jpg\n";
+            return EXIT_FAILURE;
+        }
+        const auto save_image =
+            [&](const dlib::matrix<dlib::rgb_pixel>& image, const dlib::file& file)
+        {
+            const std::string out_name =
+                output_dir + "/" + file.name().substr(0, file.name().rfind(".")) + "." + format;
+            if (format == "jpg")
+                dlib::save_jpeg(image, out_name);
+            else
+                dlib::save_png(image, out_name);
+        };
+        const auto files =
+            dlib::get_files_in_directory_tree(images_dir, dlib::match_endings(exts));
+
+        if (not parser.option("parallel"))
         {
+            std::vector<dlib::matrix<dlib::rgb_pixel>> images;
+            std::vector<std::vector<detection>> detections;
+            for (size_t i = 0; i < files.size(); i += batch_size)
+            {
+                const size_t batch_end = std::min(i + batch_size, files.size());
+                images.resize(batch_end - i);
+                for (size_t j = i; j < batch_end; ++j)
+                    dlib::load_image(images[j - i], files[j].full_name());
+                if (tiled)
+                {
+                    detections.resize(images.size());
+                    for (size_t j = 0; j < images.size(); ++j)
+                    {
+                        yolo.detect_tiled(
+                            images[j],
+                            detections[j],
+                            img_size,
+                            conf_thresh,
+                            nms_thresh,
+                            tiling);
+                    }
+                }
+                else
+                {
+                    yolo.detect_batch(images, detections, img_size, conf_thresh, nms_thresh);
+                }
+                for (size_t j = i; j < batch_end; ++j)
+                {
+                    auto& image = images[j - i];
+                    render_bounding_boxes(image, detections[j - i], labels, colors);
+                    save_image(image, files[j]);
+                    std::cerr << files[j].name() << ": " << detections[j - i].size()
+                              << " detections\n";
+                }
+            }
+            if (const auto* planner = yolo.get_activation_planner())
+                planner->print_summary(std::cout);
+            return EXIT_SUCCESS;
+        }
+
+        // Parallel mode: decode workers load the images in the order given by a work-stealing
+        // dispatcher, inference workers run their own copy of the detector on batches of them,
+        // and encode workers render and save the results.  The stages are connected by bounded
+        // queues, so decoding runs ahead of inference without loading the whole directory.
+        const size_t num_decoders = std::max(dlib::get_option(parser, "decode-workers", 2), 1);
+        const size_t num_detectors = std::max(dlib::get_option(parser, "inference-workers", 1), 1);
+        const size_t num_encoders = std::max(dlib::get_option(parser, "encode-workers", 2), 1);
+        struct image_job
+        {
+            size_t index = 0;
             dlib::matrix<dlib::rgb_pixel> image;
-            dlib::load_image(image, file.full_name());
             std::vector<detection> detections;
-            yolo.detect(image, detections, img_size, conf_thresh, nms_thresh);
-            render_bounding_boxes(image, detections, label_to_color);
-            const std::string out_name = file.name().substr(0, file.name().rfind(".")) + ".png";
-            dlib::save_png(image, output_dir + "/" + out_name);
-            std::cerr << file.name() << ": " << detections.size() << " detections\n";
+        };
+        const size_t pipe_size = 2 * num_detectors * batch_size;
+        dlib::pipe<image_job> decoded(pipe_size), encoded(pipe_size);
+        work_stealing_dispatcher dispatcher(files.size(), num_decoders);
+        std::mutex log_mutex, error_mutex;
+        std::exception_ptr error;
+        const auto fail = [&]()
+        {
+            const std::lock_guard<std::mutex> lock(error_mutex);
+            if (not error)
+                error = std::current_exception();
+            decoded.disable();
+            encoded.disable();
+        };
+
+        std::vector<std::thread> decoders, detectors, encoders;
+        for (size_t w = 0; w < num_decoders; ++w)
+        {
+            decoders.emplace_back(
+                [&, w]()
+                {
+                    try
+                    {
+                        image_job job;
+                        while (dispatcher.next(w, job.index))
+                        {
+                            try
+                            {
+                                dlib::load_image(job.image, files[job.index].full_name());
+                            }
+                            catch (const dlib::image_load_error& e)
+                            {
+                                const std::lock_guard<std::mutex> lock(log_mutex);
+                                std::cerr << files[job.index].name() << ": " << e.what() << '\n';
+                                continue;
+                            }
+                            if (not decoded.enqueue(job))
+                                break;
+                        }
+                    }
+                    catch (...)
+                    {
+                        fail();
+                    }
+                });
+        }
+        for (size_t w = 0; w < num_detectors; ++w)
+        {
+            detectors.emplace_back(
+                [&]()
+                {
+                    try
+                    {
+                        const auto detector_ptr = yolo.clone();
+                        auto& detector = *detector_ptr;
+                        std::vector<image_job> jobs(batch_size);
+                        std::vector<dlib::matrix<dlib::rgb_pixel>> images;
+                        std::vector<std::vector<detection>> detections;
+                        while (decoded.dequeue(jobs[0]))
+                        {
+                            // fill the rest of the batch with whatever is ready
+                            size_t n = 1;
+                            while (n < jobs.size() and decoded.dequeue_or_timeout(jobs[n], 0))
+                                ++n;
+                            images.resize(n);
+                            for (size_t i = 0; i < n; ++i)
+                                images[i].swap(jobs[i].image);
+                            if (tiled)
+                            {
+                                detections.resize(n);
+                                for (size_t i = 0; i < n; ++i)
+                                {
+                                    detector.detect_tiled(
+                                        images[i],
+                                        detections[i],
+                                        img_size,
+                                        conf_thresh,
+                                        nms_thresh,
+                                        tiling);
+                                }
+                            }
+                            else
+                            {
+                                detector.detect_batch(
+                                    images, detections, img_size, conf_thresh, nms_thresh);
+                            }
+                            for (size_t i = 0; i < n; ++i)
+                            {
+                                jobs[i].image.swap(images[i]);
+                                jobs[i].detections.swap(detections[i]);
+                                if (not encoded.enqueue(jobs[i]))
+                                    return;
+                            }
+                        }
+                    }
+                    catch (...)
+                    {
+                        fail();
+                    }
+                });
         }
+        for (size_t w = 0; w < num_encoders; ++w)
+        {
+            encoders.emplace_back(
+                [&]()
+                {
+                    try
+                    {
+                        image_job job;
+                        while (encoded.dequeue(job))
+                        {
+                            const auto& file = files[job.index];
+                            render_bounding_boxes(job.image, job.detections, labels, colors);
+                            save_image(job.image, file);
+                            const std::lock_guard<std::mutex> lock(log_mutex);
+                            std::cerr << file.name() << ": " << job.detections.size()
+                                      << " detections\n";
+                        }
+                    }
+                    catch (...)
+                    {
+                        fail();
+                    }
+                });
+        }
+
+        // shut the stages down in order, letting each one drain its input queue first
+        for (auto& t : decoders)
+            t.join();
+        decoded.wait_until_empty();
+        decoded.disable();
+        for (auto& t : detectors)
+            t.join();
+        encoded.wait_until_empty();
+        encoded.disable();
+        for (auto& t : encoders)
+            t.join();
+        if (error)
+            std::rethrow_exception(error);
         return EXIT_SUCCESS;
     }
 
@@ -130,40 +393,180 @@ try
             cv::Size(width, height));
     }
 
-    dlib::running_stats_decayed<float> rs(10);
-    std::cout << std::fixed << std::setprecision(2);
-    while (not win.is_closed())
+    // The video is processed by three stages, each in its own thread: capture, inference and
+    // rendering.  Frames go through bounded lock-free queues and are recycled back to the
+    // capture stage, so the number of frames in flight is fixed and their order is preserved.
+    struct frame
     {
         dlib::matrix<dlib::rgb_pixel> image;
-        cv::Mat cv_cap;
-        if (!vid_src.read(cv_cap))
-        {
-            break;
-        }
-        // convert the BRG opencv image to RGB dlib image
-        const dlib::cv_image<dlib::bgr_pixel> tmp(cv_cap);
-        if (win.mirror)
-            dlib::flip_image_left_right(tmp, image);
-        else
-            dlib::assign_image(image, tmp);
-        win.clear_overlay();
-        const auto t0 = std::chrono::steady_clock::now();
         std::vector<detection> detections;
-        yolo.detect(image, detections, img_size, win.conf_thresh, nms_thresh);
-        const auto t1 = std::chrono::steady_clock::now();
-        rs.add(std::chrono::duration_cast<std::chrono::duration<float>>(t1 - t0).count());
-        std::cout << "avg fps: " << 1.0f / rs.mean() << '\r' << std::flush;
-        if (out_width > 0)
-            dlib::resize_image(static_cast<double>(out_width) / image.nc(), image);
-        render_bounding_boxes(image, detections, label_to_color);
-        win.set_image(image);
-        if (not out_path.empty())
+    };
+    using frame_ptr = std::unique_ptr<frame>;
+    const size_t num_frames = 2 * queue_depth + 3;
+    spsc_queue<frame_ptr> captured(queue_depth), inferred(queue_depth), recycled(num_frames);
+    for (size_t i = 0; i < num_frames; ++i)
+        recycled.push(std::make_unique<frame>());
+    stage_stats capture_stats("capture"), inference_stats("inference"), render_stats("render");
+    // with --motion-thresh, frames that barely changed reuse the detections of the last frame
+    // that went through the network
+    const bool gated = parser.option("motion-thresh").count() > 0;
+    motion_gate gate(dlib::get_option(parser, "motion-thresh", 0.005));
+    gate.set_max_skipped(dlib::get_option(parser, "motion-max-skip", 0));
+    // with --track, the detector only runs on keyframes and a tracker moves the boxes between
+    const bool tracking = parser.option("track").count() > 0;
+    tracker_options track_opts;
+    track_opts.keyframe_interval = dlib::get_option(parser, "track", 5);
+    track_opts.optical_flow = parser.option("track-flow").count() > 0;
+    detection_tracker tracker(track_opts);
+    std::exception_ptr capture_error, inference_error;
+
+    std::thread capture_thread(
+        [&]()
+        {
+            try
+            {
+                cv::Mat cv_cap;
+                frame_ptr f;
+                while (not win.is_closed() and recycled.pop(f))
+                {
+                    const auto t0 = std::chrono::steady_clock::now();
+                    if (!vid_src.read(cv_cap))
+                        break;
+                    // convert the BRG opencv image to RGB dlib image
+                    const dlib::cv_image<dlib::bgr_pixel> tmp(cv_cap);
+                    if (win.mirror)
+                        dlib::flip_image_left_right(tmp, f->image);
+                    else
+                        dlib::assign_image(f->image, tmp);
+                    capture_stats.add(std::chrono::steady_clock::now() - t0);
+                    if (not captured.push(std::move(f)))
+                        break;
+                }
+            }
+            catch (...)
+            {
+                capture_error = std::current_exception();
+            }
+            captured.close();
+        });
+
+    std::thread inference_thread(
+        [&]()
+        {
+            try
+            {
+                frame_ptr f;
+                std::vector<detection> last_detections;
+                while (captured.pop(f))
+                {
+                    const auto t0 = std::chrono::steady_clock::now();
+                    f->detections.clear();
+                    if (gated and not gate.update(f->image))
+                    {
+                        f->detections = last_detections;
+                    }
+                    else if (tracking and not tracker.needs_detection())
+                    {
+                        tracker.predict(f->detections, f->image);
+                    }
+                    else
+                    {
+                        if (tiled)
+                        {
+                            yolo.detect_tiled(
+                                f->image,
+                                f->detections,
+                                img_size,
+                                win.conf_thresh,
+                                nms_thresh,
+                                tiling);
+                        }
+                        else
+                        {
+                            yolo.detect(
+                                f->image,
+                                f->detections,
+                                img_size,
+                                win.conf_thresh,
+                                nms_thresh);
+                        }
+                        if (tracking)
+                            tracker.update(f->detections, f->image);
+                    }
+                    if (gated)
+                        last_detections = f->detections;
+                    inference_stats.add(std::chrono::steady_clock::now() - t0);
+                    if (not inferred.push(std::move(f)))
+                        break;
+                }
+            }
+            catch (...)
+            {
+                inference_error = std::current_exception();
+            }
+            captured.close();
+            inferred.close();
+            recycled.close();
+        });
+
+    std::exception_ptr render_error;
+    dlib::matrix<dlib::bgr_pixel> bgr_img;
+    auto last_report = std::chrono::steady_clock::now();
+    frame_ptr f;
+    try
+    {
+        while (inferred.pop(f))
         {
-            dlib::matrix<dlib::bgr_pixel> bgr_img(height, width);
-            dlib::assign_image(bgr_img, image);
-            vid_snk.write(dlib::toMat(bgr_img));
+            const auto t0 = std::chrono::steady_clock::now();
+            auto& image = f->image;
+            if (out_width > 0)
+                dlib::resize_image(static_cast<double>(out_width) / image.nc(), image);
+            render_bounding_boxes(image, f->detections, labels, colors);
+            win.clear_overlay();
+            win.set_image(image);
+            if (not out_path.empty())
+            {
+                bgr_img.set_size(height, width);
+                dlib::assign_image(bgr_img, image);
+                vid_snk.write(dlib::toMat(bgr_img));
+            }
+            render_stats.add(std::chrono::steady_clock::now() - t0);
+            recycled.push(std::move(f));
+            if (t0 - last_report > std::chrono::seconds(1))
+            {
+                std::cout << capture_stats << " | " << inference_stats << " | " << render_stats;
+                if (gated)
+                    std::cout << " | " << gate;
+                std::cout << "    \r" << std::flush;
+                last_report = t0;
+            }
         }
     }
+    catch (...)
+    {
+        render_error = std::current_exception();
+        inferred.close();
+        captured.close();
+    }
+    recycled.close();
+    capture_thread.join();
+    inference_thread.join();
+    std::cout << '\n';
+    for (const auto* stats : {&capture_stats, &inference_stats, &render_stats})
+        std::cout << *stats << " (" << stats->get_items() << " frames)\n";
+    if (const auto* planner = yolo.get_activation_planner())
+        planner->print_summary(std::cout);
+    if (gated)
+    {
+        std::cout << "gate: " << gate.get_num_inferred() << " frames inferred, "
+                  << gate.get_num_skipped() << " skipped\n";
+    }
+    for (const auto& error : {capture_error, inference_error, render_error})
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
     if (not out_path.empty())
         vid_snk.release();
 
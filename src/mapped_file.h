@@ -0,0 +1,84 @@
+#ifndef mapped_file_h_INCLUDED
+#define mapped_file_h_INCLUDED
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_USE_MMAP
+#endif
+
+// A read-only view of a whole file.  On POSIX systems the file is memory mapped, so its pages
+// are loaded on demand and shared with the page cache instead of being copied into the heap.
+// Elsewhere the file is read into memory with a single bulk read.
+class mapped_file
+{
+    public:
+    explicit mapped_file(const std::string& path)
+    {
+#ifdef MAPPED_FILE_USE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("unable to open '" + path + "'");
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("unable to get the size of '" + path + "'");
+        }
+        size_ = st.st_size;
+        if (size_ > 0)
+        {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("unable to map '" + path + "' into memory");
+            }
+            // the pages are read once, front to back
+            ::madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(addr);
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (not file)
+            throw std::runtime_error("unable to open '" + path + "'");
+        size_ = file.tellg();
+        buffer.resize(size_);
+        file.seekg(0);
+        if (not file.read(buffer.data(), size_))
+            throw std::runtime_error("unable to read '" + path + "'");
+        data_ = buffer.data();
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file()
+    {
+#ifdef MAPPED_FILE_USE_MMAP
+        if (data_ != nullptr)
+            ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifndef MAPPED_FILE_USE_MMAP
+    std::vector<char> buffer;
+#endif
+};
+
+#endif  // mapped_file_h_INCLUDED
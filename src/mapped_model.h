@@ -0,0 +1,288 @@
+#ifndef darknet_mapped_model_h_INCLUDED
+#define darknet_mapped_model_h_INCLUDED
+
+#include "layers.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <dlib/dnn.h>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <typeinfo>
+
+namespace darknet
+{
+    using namespace dlib;
+
+    // A network file that can be loaded without parsing the parameters through a stream.  It
+    // contains a fixed header, a table with the offset and shape of the parameters of every
+    // computational layer, the network serialized with dlib without any parameters (the
+    // "skeleton", which holds the layer settings), and the parameters themselves, each at an
+    // offset aligned to mapped_model_alignment bytes.  Loading maps the file, deserializes the
+    // small skeleton from memory and copies every parameter tensor with a single memcpy.  The
+    // fused_con_ layers in f16 or bf16 keep their filters out of their parameters, so these get
+    // an entry of their own, right after the one of the parameters of the layer, which holds
+    // the 16-bit values with num_samples set to their count.  Version 1 files kept them in the
+    // skeleton and are still loaded.
+    //
+    // The network type is identified by a hash of its type name, which is only stable for a
+    // given compiler, so the files are meant to be generated by the tools of the same build.
+
+    constexpr char mapped_model_magic[8] = {'D', 'K', 'N', 'M', 'O', 'D', 'E', 'L'};
+    constexpr uint32_t mapped_model_version = 2;
+    constexpr uint64_t mapped_model_alignment = 64;
+
+    struct mapped_model_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_layers;
+        uint64_t type_hash;
+        uint64_t num_tensors;
+        uint64_t skeleton_offset;
+        uint64_t skeleton_size;
+    };
+
+    struct mapped_tensor_entry
+    {
+        uint64_t offset;
+        int64_t num_samples, k, nr, nc;
+    };
+
+    template <typename net_type> uint64_t get_type_hash()
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (const char* c = typeid(net_type).name(); *c != '\0'; ++c)
+        {
+            hash ^= static_cast<unsigned char>(*c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    namespace detail
+    {
+        inline uint64_t align_offset(const uint64_t offset)
+        {
+            return (offset + mapped_model_alignment - 1) / mapped_model_alignment *
+                   mapped_model_alignment;
+        }
+
+        // a * b, or false if it overflows
+        inline bool checked_multiply(const uint64_t a, const uint64_t b, uint64_t& result)
+        {
+            if (b != 0 and a > std::numeric_limits<uint64_t>::max() / b)
+                return false;
+            result = a * b;
+            return true;
+        }
+
+        // whether the size bytes at offset lie within a file of file_size bytes
+        inline bool in_file(const uint64_t offset, const uint64_t size, const uint64_t file_size)
+        {
+            return offset <= file_size and size <= file_size - offset;
+        }
+
+        // a read-only stream buffer over a memory range, so the skeleton is not copied
+        class memory_buffer : public std::streambuf
+        {
+            public:
+            memory_buffer(const char* data, const size_t size)
+            {
+                char* begin = const_cast<char*>(data);
+                setg(begin, begin, begin + size);
+            }
+        };
+    }  // namespace detail
+
+    inline bool is_mapped_model(const std::string& path)
+    {
+        char magic[sizeof(mapped_model_magic)] = {};
+        std::ifstream fin(path, std::ios::binary);
+        fin.read(magic, sizeof(magic));
+        return fin and std::memcmp(magic, mapped_model_magic, sizeof(magic)) == 0;
+    }
+
+    template <typename net_type> void save_mapped(const net_type& net, const std::string& path)
+    {
+        // the data of every entry of the table, in the order of the table
+        struct buffer
+        {
+            const char* data;
+            uint64_t size;
+            int64_t num_samples, k, nr, nc;
+        };
+        std::vector<buffer> buffers;
+        visit_computational_layers(
+            const_cast<net_type&>(net),
+            [&buffers](const auto& l)
+            {
+                const tensor& params = l.get_layer_params();
+                buffers.push_back(
+                    {reinterpret_cast<const char*>(params.host()),
+                     params.size() * sizeof(float),
+                     params.num_samples(),
+                     params.k(),
+                     params.nr(),
+                     params.nc()});
+                if constexpr (is_fused_con<std::decay_t<decltype(l)>>::value)
+                {
+                    if (is_half_precision(l.get_precision()))
+                    {
+                        const auto& half_filters = l.get_half_filters();
+                        buffers.push_back(
+                            {reinterpret_cast<const char*>(half_filters.data()),
+                             half_filters.size() * sizeof(uint16_t),
+                             static_cast<int64_t>(half_filters.size()),
+                             1,
+                             1,
+                             1});
+                    }
+                }
+            });
+
+        net_type skeleton = net;
+        skeleton.clean();
+        visit_computational_layers(
+            skeleton,
+            [](auto& l)
+            {
+                dynamic_cast<resizable_tensor&>(l.get_layer_params()).clear();
+                if constexpr (is_fused_con<std::decay_t<decltype(l)>>::value)
+                {
+                    l.get_half_filters().clear();
+                    l.get_half_filters().shrink_to_fit();
+                }
+            });
+        std::ostringstream sout;
+        serialize(skeleton, sout);
+        const std::string skeleton_data = sout.str();
+
+        mapped_model_header header;
+        std::memcpy(header.magic, mapped_model_magic, sizeof(header.magic));
+        header.version = mapped_model_version;
+        header.num_layers = net_type::num_layers;
+        header.type_hash = get_type_hash<net_type>();
+        header.num_tensors = buffers.size();
+        header.skeleton_offset =
+            sizeof(mapped_model_header) + buffers.size() * sizeof(mapped_tensor_entry);
+        header.skeleton_size = skeleton_data.size();
+
+        std::vector<mapped_tensor_entry> entries(buffers.size());
+        uint64_t offset = header.skeleton_offset + header.skeleton_size;
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            offset = detail::align_offset(offset);
+            entries[i].offset = offset;
+            entries[i].num_samples = buffers[i].num_samples;
+            entries[i].k = buffers[i].k;
+            entries[i].nr = buffers[i].nr;
+            entries[i].nc = buffers[i].nc;
+            offset += buffers[i].size;
+        }
+
+        std::ofstream fout(path, std::ios::binary);
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        fout.write(
+            reinterpret_cast<const char*>(entries.data()),
+            entries.size() * sizeof(mapped_tensor_entry));
+        fout.write(skeleton_data.data(), skeleton_data.size());
+        const char padding[mapped_model_alignment] = {};
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            fout.write(padding, entries[i].offset - fout.tellp());
+            fout.write(buffers[i].data, buffers[i].size);
+        }
+        if (not fout)
+            throw std::runtime_error("error while writing '" + path + "'");
+    }
+
+    template <typename net_type> void load_mapped(net_type& net, const std::string& path)
+    {
+        const mapped_file file(path);
+        const auto fail = [&path](const std::string& reason)
+        { throw serialization_error("unable to load '" + path + "': " + reason); };
+
+        mapped_model_header header;
+        if (file.size() < sizeof(header))
+            fail("the file is too small");
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, mapped_model_magic, sizeof(header.magic)) != 0)
+            fail("not a mapped model file");
+        if (header.version != 1 and header.version != mapped_model_version)
+            fail("unsupported version " + std::to_string(header.version));
+        if (header.type_hash != get_type_hash<net_type>() or
+            header.num_layers != net_type::num_layers)
+            fail("the file contains a different network");
+        uint64_t table_size;
+        const uint64_t entry_bytes = sizeof(mapped_tensor_entry);
+        if (not detail::checked_multiply(header.num_tensors, entry_bytes, table_size) or
+            not detail::in_file(sizeof(header), table_size, header.skeleton_offset) or
+            not detail::in_file(header.skeleton_offset, header.skeleton_size, file.size()))
+            fail("the file is truncated");
+
+        detail::memory_buffer buffer(file.data() + header.skeleton_offset, header.skeleton_size);
+        std::istream in(&buffer);
+        deserialize(net, in);
+
+        size_t i = 0;
+        const auto next_entry = [&]()
+        {
+            if (i == header.num_tensors)
+                fail("the file has fewer layers than the network");
+            mapped_tensor_entry entry;
+            std::memcpy(
+                &entry,
+                file.data() + sizeof(header) + i++ * sizeof(mapped_tensor_entry),
+                sizeof(entry));
+            return entry;
+        };
+        // the size in bytes of the values of an entry, which must lie within the file
+        const auto entry_size = [&](const mapped_tensor_entry& entry, const uint64_t value_size)
+        {
+            uint64_t size = value_size;
+            for (const int64_t dim : {entry.num_samples, entry.k, entry.nr, entry.nc})
+            {
+                if (dim < 0 or not detail::checked_multiply(size, dim, size))
+                    fail("the file has a tensor with invalid dimensions");
+            }
+            if (entry.offset % mapped_model_alignment != 0 or
+                not detail::in_file(entry.offset, size, file.size()))
+                fail("the file is truncated");
+            return size;
+        };
+        visit_computational_layers(
+            net,
+            [&](auto& l)
+            {
+                const mapped_tensor_entry entry = next_entry();
+                const uint64_t size = entry_size(entry, sizeof(float));
+                auto& params = dynamic_cast<resizable_tensor&>(l.get_layer_params());
+                params.set_size(entry.num_samples, entry.k, entry.nr, entry.nc);
+                std::memcpy(params.host(), file.data() + entry.offset, size);
+
+                if constexpr (is_fused_con<std::decay_t<decltype(l)>>::value)
+                {
+                    if (header.version == 1 or not is_half_precision(l.get_precision()))
+                        return;
+                    const mapped_tensor_entry half_entry = next_entry();
+                    const uint64_t count = l.num_filters() * l.num_inputs() * l.nr() * l.nc();
+                    if (entry_size(half_entry, sizeof(uint16_t)) != count * sizeof(uint16_t))
+                        fail("the half-precision filters have a wrong size");
+                    auto& half_filters = l.get_half_filters();
+                    half_filters.resize(count);
+                    std::memcpy(
+                        half_filters.data(),
+                        file.data() + half_entry.offset,
+                        count * sizeof(uint16_t));
+                }
+            });
+        if (i != header.num_tensors)
+            fail("the file has more layers than the network");
+    }
+}  // namespace darknet
+
+#endif  // darknet_mapped_model_h_INCLUDED
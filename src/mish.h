@@ -0,0 +1,138 @@
+#ifndef darknet_mish_h_INCLUDED
+#define darknet_mish_h_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Mish activation, x * tanh(softplus(x)), for the inference of the Mish models on the CPU.
+// With e = exp(x), tanh(log(1 + e)) = n / (n + 2) where n = e * (e + 2), so it only needs a
+// single exponential.  Unlike dlib's x - 2 * x / (n + 2), this form does not cancel for the
+// negative inputs, where mish(x) tends to x * e.  The exponential is clamped at 20, above
+// which n / (n + 2) rounds to 1 in float anyway, so n never overflows.
+//
+// The vectorized kernels evaluate exp with the Cephes polynomial after a range reduction by
+// ln(2), and the division exactly.  Over [-20, 20], their largest error against mish in double
+// precision is 4.5 ulp of the result, or 3.2e-7 relative, as good as with the exp of the
+// standard library (see bench --mish).  They clamp the exponential at -87, where mish is
+// below 2e-36 anyway, so it stays a normal float.
+namespace darknet
+{
+    constexpr float mish_exp_max = 20.f;
+    constexpr float mish_exp_min = -87.f;
+
+    // the reference implementation, with the exp of the standard library
+    inline float mish_exact(const float x)
+    {
+        const float e = std::exp(std::min(x, mish_exp_max));
+        const float n = e * (e + 2);
+        return x * (n / (n + 2));
+    }
+
+#if defined(__AVX512F__)
+    inline __m512 mish_avx512(const __m512 x)
+    {
+        const __m512 t = _mm512_max_ps(
+            _mm512_min_ps(x, _mm512_set1_ps(mish_exp_max)),
+            _mm512_set1_ps(mish_exp_min));
+        // exp(t) = 2^k * exp(r) with k = round(t / ln(2)) and |r| <= ln(2) / 2
+        const __m512 k = _mm512_roundscale_ps(
+            _mm512_mul_ps(t, _mm512_set1_ps(1.44269504088896341f)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(0.693359375f), t);
+        r = _mm512_fnmadd_ps(k, _mm512_set1_ps(-2.12194440e-4f), r);
+        __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+        p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1)));
+        const __m512i exponent = _mm512_slli_epi32(
+            _mm512_add_epi32(_mm512_cvtps_epi32(k), _mm512_set1_epi32(127)),
+            23);
+        const __m512 e = _mm512_mul_ps(p, _mm512_castsi512_ps(exponent));
+        const __m512 n = _mm512_mul_ps(e, _mm512_add_ps(e, _mm512_set1_ps(2)));
+        return _mm512_mul_ps(x, _mm512_div_ps(n, _mm512_add_ps(n, _mm512_set1_ps(2))));
+    }
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+    inline __m256 mish_avx2(const __m256 x)
+    {
+        const __m256 t = _mm256_max_ps(
+            _mm256_min_ps(x, _mm256_set1_ps(mish_exp_max)),
+            _mm256_set1_ps(mish_exp_min));
+        // exp(t) = 2^k * exp(r) with k = round(t / ln(2)) and |r| <= ln(2) / 2
+        const __m256 k = _mm256_round_ps(
+            _mm256_mul_ps(t, _mm256_set1_ps(1.44269504088896341f)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(0.693359375f), t);
+        r = _mm256_fnmadd_ps(k, _mm256_set1_ps(-2.12194440e-4f), r);
+        __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1)));
+        const __m256i exponent = _mm256_slli_epi32(
+            _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)),
+            23);
+        const __m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+        const __m256 n = _mm256_mul_ps(e, _mm256_add_ps(e, _mm256_set1_ps(2)));
+        return _mm256_mul_ps(x, _mm256_div_ps(n, _mm256_add_ps(n, _mm256_set1_ps(2))));
+    }
+#endif
+
+    // Applies mish to the n values of in and stores them to out, which may be in itself.  The
+    // last values go through the same kernel as the others, so the result of a value does not
+    // depend on its position.
+    inline void apply_mish(const float* in, float* out, const size_t n)
+    {
+#if defined(__AVX512F__)
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(out + i, mish_avx512(_mm512_loadu_ps(in + i)));
+        if (i < n)
+        {
+            const __mmask16 mask = (1u << (n - i)) - 1;
+            const __m512 x = _mm512_maskz_loadu_ps(mask, in + i);
+            _mm512_mask_storeu_ps(out + i, mask, mish_avx512(x));
+        }
+#elif defined(__AVX2__) && defined(__FMA__)
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, mish_avx2(_mm256_loadu_ps(in + i)));
+        if (i < n)
+        {
+            float tail[8] = {};
+            std::copy(in + i, in + n, tail);
+            _mm256_storeu_ps(tail, mish_avx2(_mm256_loadu_ps(tail)));
+            std::copy(tail, tail + (n - i), out + i);
+        }
+#else
+        for (size_t i = 0; i < n; ++i)
+            out[i] = mish_exact(in[i]);
+#endif
+    }
+
+    inline void apply_mish(float* data, const size_t n) { apply_mish(data, data, n); }
+
+    // the instruction set used by apply_mish(), for the benchmarks
+    inline const char* mish_kernel_name()
+    {
+#if defined(__AVX512F__)
+        return "avx512";
+#elif defined(__AVX2__) && defined(__FMA__)
+        return "avx2";
+#else
+        return "scalar";
+#endif
+    }
+}  // namespace darknet
+
+#endif  // darknet_mish_h_INCLUDED
@@ -0,0 +1,64 @@
+#ifndef model_entries_h_INCLUDED
+#define model_entries_h_INCLUDED
+
+#include "models.h"
+
+// The entry points of the models in the registry, see get_models().  They are defined in the
+// translation unit of each model, and this header only includes models.h, so the registry
+// does not instantiate the networks.
+
+std::unique_ptr<object_detector> load_yolov3(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov3(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov3(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+std::unique_ptr<object_detector> load_yolov4(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov4(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov4(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+std::unique_ptr<object_detector> load_yolov4_sam_mish(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov4_sam_mish(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov4_sam_mish(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+std::unique_ptr<object_detector> load_yolov4x_mish(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov4x_mish(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov4x_mish(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+std::unique_ptr<object_detector> load_yolov3_tiny(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov3_tiny(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov3_tiny(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+std::unique_ptr<object_detector> load_yolov4_tiny(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    bool fused);
+void convert_yolov4_tiny(const conversion_options& options);
+std::unique_ptr<object_detector> prune_yolov4_tiny(
+    const object_detector& detector,
+    const model_pruning_options& options);
+
+#endif  // model_entries_h_INCLUDED
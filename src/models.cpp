@@ -0,0 +1,34 @@
+#include "models.h"
+
+#include "model_entries.h"
+
+const std::vector<model_entry>& get_models()
+{
+    static const std::vector<model_entry> models{
+        {"yolov3", load_yolov3, convert_yolov3, prune_yolov3},
+        {"yolov4", load_yolov4, convert_yolov4, prune_yolov4},
+        {"yolov4-sam-mish", load_yolov4_sam_mish, convert_yolov4_sam_mish, prune_yolov4_sam_mish},
+        {"yolov4x-mish", load_yolov4x_mish, convert_yolov4x_mish, prune_yolov4x_mish},
+        {"yolov3-tiny", load_yolov3_tiny, convert_yolov3_tiny, prune_yolov3_tiny},
+        {"yolov4-tiny", load_yolov4_tiny, convert_yolov4_tiny, prune_yolov4_tiny},
+    };
+    return models;
+}
+
+const model_entry& get_model(const std::string& name)
+{
+    for (const auto& model : get_models())
+    {
+        if (model.name == name)
+            return model;
+    }
+    throw std::runtime_error("unknown model '" + name + "', expected one of " + get_model_names());
+}
+
+std::string get_model_names()
+{
+    std::string names;
+    for (const auto& model : get_models())
+        names += (names.empty() ? "" : ", ") + model.name;
+    return names;
+}
@@ -0,0 +1,69 @@
+#ifndef models_h_INCLUDED
+#define models_h_INCLUDED
+
+#include "detector.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Settings of the conversion of darknet weights, see convert_weights.
+struct conversion_options
+{
+    std::string weights_path;
+    long num_classes = 80;
+    long img_size = 416;
+    // build the network with the batch normalization folded into the convolutions, whose
+    // filters are stored in the given precision: f32, f16 or bf16
+    bool fused = false;
+    std::string precision = "f32";
+    // run the fused network and the one without --fused on the same image before the filters
+    // are stored in the given precision, and throw if their yolo outputs differ
+    bool check = false;
+    std::string save_path;
+    std::string save_mapped_path;
+    bool print = false;
+};
+
+// Settings of the channel pruning of a converted model, see prune.
+struct model_pruning_options
+{
+    // the darknet weights the model was converted from, whose batch normalizations rank the
+    // channels
+    std::string weights_path;
+    long img_size = 416;
+    // fraction of the FLOPs of the convolutions to keep
+    double flops_ratio = 0.5;
+    // fraction of the channels of each convolution that is never pruned
+    double min_channels_ratio = 0.1;
+};
+
+// A model the tools select at runtime by its name.  The networks of each model are only
+// instantiated in its own translation unit, so the tools that go through the registry do not
+// compile them.
+struct model_entry
+{
+    std::string name;
+    // loads a network saved by convert_weights, which was converted with --fused or not
+    std::unique_ptr<object_detector> (*load)(
+        const std::string& dnn_path,
+        const std::string& labels_path,
+        bool fused);
+    // converts darknet weights to the networks of the model
+    void (*convert)(const conversion_options& options);
+    // prunes the channels of a detector given by load(), prints a summary and returns the
+    // pruned detector
+    std::unique_ptr<object_detector> (*prune)(
+        const object_detector& detector,
+        const model_pruning_options& options);
+};
+
+const std::vector<model_entry>& get_models();
+
+// Finds a model by its name, e.g. "yolov4x-mish", and throws if there is none.
+const model_entry& get_model(const std::string& name);
+
+// the names of the models separated by commas, for the help of the tools
+std::string get_model_names();
+
+#endif  // models_h_INCLUDED
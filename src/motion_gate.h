@@ -0,0 +1,124 @@
+#ifndef motion_gate_h_INCLUDED
+#define motion_gate_h_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+// Decides whether a video frame changed enough since the last inferred frame to be worth
+// running the network, for static cameras where most frames show the same scene.  Each frame
+// is reduced to a grid of average luminances, about grid_width cells wide, and the motion score
+// is the fraction of cells whose luminance moved by more than cell_thresh levels from the
+// last inferred frame.  Comparing with the last inferred frame, rather than the previous one,
+// makes slow changes add up until they trigger an inference.
+//
+// The statistics can be read from another thread while the gate is updated.
+class motion_gate
+{
+    public:
+    static constexpr long grid_width = 64;
+    static constexpr int cell_thresh = 12;
+
+    // frames whose motion score is below threshold reuse the previous detections
+    explicit motion_gate(const float threshold = 0.005) : threshold(threshold) {}
+
+    // Forces an inference after max_skipped frames in a row were skipped (0: never).
+    void set_max_skipped(const long max_skipped) { this->max_skipped = max_skipped; }
+    long get_max_skipped() const { return max_skipped; }
+
+    float get_threshold() const { return threshold; }
+
+    // Returns true if the frame should go through the network.
+    bool update(const dlib::matrix<dlib::rgb_pixel>& frame)
+    {
+        compute_grid(frame, grid);
+        bool infer = true;
+        if (grid.size() == reference.size())
+        {
+            long num_moved = 0;
+            for (size_t i = 0; i < grid.size(); ++i)
+                num_moved += std::abs(grid[i] - reference[i]) > cell_thresh;
+            const float score = static_cast<float>(num_moved) / grid.size();
+            last_score.store(score, std::memory_order_relaxed);
+            infer = score >= threshold or (max_skipped > 0 and skipped_in_row >= max_skipped);
+        }
+        if (infer)
+        {
+            reference.swap(grid);
+            skipped_in_row = 0;
+            num_inferred.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            ++skipped_in_row;
+            num_skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return infer;
+    }
+
+    long get_num_inferred() const { return num_inferred.load(std::memory_order_relaxed); }
+    long get_num_skipped() const { return num_skipped.load(std::memory_order_relaxed); }
+
+    // motion score of the last frame compared with a reference, in [0, 1]
+    float get_last_score() const { return last_score.load(std::memory_order_relaxed); }
+
+    // fraction of the frames that reused the previous detections
+    double get_skip_ratio() const
+    {
+        const long total = get_num_inferred() + get_num_skipped();
+        return total > 0 ? static_cast<double>(get_num_skipped()) / total : 0;
+    }
+
+    private:
+    // Averages the luminance of the frame over cells of cell_size pixels, reading every other
+    // row and column, which is plenty to see motion and keeps the gate far cheaper than the
+    // network.
+    static void compute_grid(const dlib::matrix<dlib::rgb_pixel>& frame, std::vector<int>& grid)
+    {
+        const long cell_size = std::max(1l, (frame.nc() + grid_width - 1) / grid_width);
+        const long grid_nc = (frame.nc() + cell_size - 1) / cell_size;
+        const long grid_nr = (frame.nr() + cell_size - 1) / cell_size;
+        thread_local std::vector<long> sums, counts;
+        sums.assign(grid_nr * grid_nc, 0);
+        counts.assign(grid_nr * grid_nc, 0);
+        for (long r = 0; r < frame.nr(); r += 2)
+        {
+            const long row = (r / cell_size) * grid_nc;
+            for (long c = 0; c < frame.nc(); c += 2)
+            {
+                const auto& p = frame(r, c);
+                // integer approximation of the BT.601 luma
+                sums[row + c / cell_size] += (77 * p.red + 150 * p.green + 29 * p.blue) >> 8;
+                ++counts[row + c / cell_size];
+            }
+        }
+        grid.resize(sums.size());
+        for (size_t i = 0; i < grid.size(); ++i)
+            grid[i] = counts[i] > 0 ? sums[i] / counts[i] : 0;
+    }
+
+    float threshold;
+    long max_skipped = 0;
+    long skipped_in_row = 0;
+    std::vector<int> grid, reference;
+    std::atomic<long> num_inferred{0};
+    std::atomic<long> num_skipped{0};
+    std::atomic<float> last_score{0};
+};
+
+inline std::ostream& operator<<(std::ostream& out, const motion_gate& g)
+{
+    const auto flags = out.flags();
+    out << "gate: " << std::fixed << std::setprecision(0) << 100 * g.get_skip_ratio()
+        << "% skipped, motion " << std::setprecision(3) << g.get_last_score();
+    out.flags(flags);
+    return out;
+}
+
+#endif  // motion_gate_h_INCLUDED
@@ -0,0 +1,217 @@
+#ifndef pipeline_h_INCLUDED
+#define pipeline_h_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A bounded lock-free queue with one producer thread and one consumer thread.  The blocking
+// push() and pop() back off to sleeping when the queue stays full or empty, so idle stages do
+// not steal cycles from the busy ones.  After close(), push() fails and pop() fails once the
+// queue has been drained.
+template <typename T> class spsc_queue
+{
+    public:
+    explicit spsc_queue(const size_t capacity) : buffer(capacity + 1) {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    bool try_push(T& item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        buffer[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(buffer[h]);
+        head.store(increment(h), std::memory_order_release);
+        return true;
+    }
+
+    bool push(T&& item)
+    {
+        for (size_t attempt = 0; not closed.load(std::memory_order_acquire); ++attempt)
+        {
+            if (try_push(item))
+                return true;
+            backoff(attempt);
+        }
+        return false;
+    }
+
+    bool pop(T& item)
+    {
+        for (size_t attempt = 0;; ++attempt)
+        {
+            if (try_pop(item))
+                return true;
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(item);
+            backoff(attempt);
+        }
+    }
+
+    void close() { closed.store(true, std::memory_order_release); }
+
+    size_t size() const
+    {
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + buffer.size() - h;
+    }
+
+    size_t capacity() const { return buffer.size() - 1; }
+
+    private:
+    size_t increment(const size_t i) const { return i + 1 == buffer.size() ? 0 : i + 1; }
+
+    static void backoff(const size_t attempt)
+    {
+        if (attempt < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::vector<T> buffer;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+};
+
+// Hands out the indices [0, num_items) to a fixed set of workers.  Each worker starts with its
+// own contiguous range, which it consumes from the front.  Once it runs out, it steals from the
+// back of the range of the worker with the most items left, so a few slow items do not leave
+// the other workers idle.
+class work_stealing_dispatcher
+{
+    public:
+    work_stealing_dispatcher(const size_t num_items, const size_t num_workers)
+        : ranges(std::max<size_t>(num_workers, 1))
+    {
+        const size_t chunk = (num_items + ranges.size() - 1) / ranges.size();
+        for (size_t i = 0; i < num_items; ++i)
+            ranges[i / chunk].items.push_back(i);
+    }
+
+    work_stealing_dispatcher(const work_stealing_dispatcher&) = delete;
+    work_stealing_dispatcher& operator=(const work_stealing_dispatcher&) = delete;
+
+    // Gets the next item for the given worker, returns false once every item has been given out.
+    bool next(const size_t worker, size_t& item)
+    {
+        {
+            auto& own = ranges[worker];
+            const std::lock_guard<std::mutex> lock(own.mutex);
+            if (not own.items.empty())
+            {
+                item = own.items.front();
+                own.items.pop_front();
+                return true;
+            }
+        }
+        for (;;)
+        {
+            size_t victim = ranges.size(), most = 0;
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                const std::lock_guard<std::mutex> lock(ranges[i].mutex);
+                if (ranges[i].items.size() > most)
+                {
+                    most = ranges[i].items.size();
+                    victim = i;
+                }
+            }
+            if (victim == ranges.size())
+                return false;
+            auto& other = ranges[victim];
+            const std::lock_guard<std::mutex> lock(other.mutex);
+            // the range may have been emptied since we looked at it, try again if so
+            if (not other.items.empty())
+            {
+                item = other.items.back();
+                other.items.pop_back();
+                return true;
+            }
+        }
+    }
+
+    private:
+    struct alignas(64) range
+    {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+    std::vector<range> ranges;
+};
+
+// Counts the items processed by a pipeline stage and the time it spent working on them, as
+// opposed to waiting on its queues.  Stages update it from their own thread and it can be
+// reported from any other.
+class stage_stats
+{
+    public:
+    using clock = std::chrono::steady_clock;
+
+    explicit stage_stats(std::string name) : name(std::move(name)), start(clock::now()) {}
+
+    void add(const clock::duration busy)
+    {
+        busy_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(),
+            std::memory_order_relaxed);
+        items.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const std::string& get_name() const { return name; }
+
+    long get_items() const { return items.load(std::memory_order_relaxed); }
+
+    // items per second since the stage was created
+    double get_throughput() const { return get_items() / get_elapsed(); }
+
+    // fraction of the time since the stage was created spent working
+    double get_utilization() const
+    {
+        return busy_ns.load(std::memory_order_relaxed) * 1e-9 / get_elapsed();
+    }
+
+    private:
+    double get_elapsed() const
+    {
+        return std::max(std::chrono::duration<double>(clock::now() - start).count(), 1e-9);
+    }
+
+    std::string name;
+    clock::time_point start;
+    std::atomic<long long> busy_ns{0};
+    std::atomic<long> items{0};
+};
+
+inline std::ostream& operator<<(std::ostream& out, const stage_stats& s)
+{
+    const auto flags = out.flags();
+    out << s.get_name() << ": " << std::fixed << std::setprecision(1) << s.get_throughput()
+        << " fps, " << std::setprecision(0) << 100 * s.get_utilization() << "% busy";
+    out.flags(flags);
+    return out;
+}
+
+#endif  // pipeline_h_INCLUDED
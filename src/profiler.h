@@ -0,0 +1,274 @@
+#ifndef darknet_profiler_h_INCLUDED
+#define darknet_profiler_h_INCLUDED
+
+#include <algorithm>
+#include <chrono>
+#include <dlib/dnn.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <type_traits>
+
+namespace darknet
+{
+    using namespace dlib;
+
+    // Statistics of one computational layer over the profiled forward passes.  The FLOPs and the
+    // bytes are estimates: convolutions count a multiply-add per filter tap as two operations,
+    // pooling layers one per window element and the other layers one per output element, and
+    // the bytes are the input, output and parameter tensors read or written once.
+    struct layer_profile
+    {
+        size_t index = 0;  // position from the output, as in dlib::layer<index>(net)
+        std::string name;
+        std::string description;
+        long num_samples = 0, k = 0, nr = 0, nc = 0;
+        double flops = 0;
+        double bytes = 0;
+        std::vector<double> times_us;
+
+        double total_us() const { return std::accumulate(times_us.begin(), times_us.end(), 0.); }
+        double mean_us() const { return times_us.empty() ? 0 : total_us() / times_us.size(); }
+    };
+
+    namespace detail
+    {
+        template <typename T, typename = void> struct has_get_output : std::false_type
+        {
+        };
+        template <typename T>
+        struct has_get_output<T, std::void_t<decltype(std::declval<const T&>().get_output())>>
+            : std::true_type
+        {
+        };
+
+        template <typename T, typename = void> struct has_filter_size : std::false_type
+        {
+        };
+        template <typename T>
+        struct has_filter_size<
+            T,
+            std::void_t<decltype(std::declval<const T&>().nr() * std::declval<const T&>().nc())>>
+            : std::true_type
+        {
+        };
+
+        template <typename T, typename = void> struct has_num_filters : std::false_type
+        {
+        };
+        template <typename T>
+        struct has_num_filters<T, std::void_t<decltype(std::declval<const T&>().num_filters())>>
+            : std::true_type
+        {
+        };
+    }  // namespace detail
+
+    // Records the wall time of every computational layer of a network.  Since a dlib network
+    // runs the whole forward pass as a single recursive call, each pass is first run normally,
+    // which caches the input of every layer, and then every layer is run again on its own,
+    // from the input to the output, into a scratch tensor.  The layer outputs and the detector
+    // results are therefore those of the normal pass.  With CUDA the times only cover the
+    // kernel launches, unless the device is synchronized by the layers themselves.
+    template <typename net_type> class layer_profiler
+    {
+        public:
+        explicit layer_profiler(net_type& net) : net(net), start(clock::now()) {}
+
+        template <typename image_type> void profile(const image_type& image)
+        {
+            net.to_tensor(&image, &image + 1, input);
+            profile(input);
+        }
+
+        void profile(const tensor& x)
+        {
+            const auto t0 = clock::now();
+            net.forward(x);
+            const auto t1 = clock::now();
+            passes.push_back({elapsed_us(t0), elapsed_us(t1)});
+            // visit_layers goes from the output to the input, but the layers are replayed in the
+            // order of the forward pass, so their events line up in the trace
+            std::vector<std::function<void()>> replays;
+            visit_layers(net, [&](size_t i, auto& l) { add_replay(i, l, replays); });
+            for (auto r = replays.rbegin(); r != replays.rend(); ++r)
+                (*r)();
+        }
+
+        // layers in the order of the forward pass
+        std::vector<layer_profile> get_layers() const
+        {
+            std::vector<layer_profile> result;
+            for (auto i = layers.rbegin(); i != layers.rend(); ++i)
+                result.push_back(i->second);
+            return result;
+        }
+
+        // Prints one row per layer, followed by the totals per layer type.
+        void print_summary(std::ostream& out) const
+        {
+            const auto profiles = get_layers();
+            double total = 0;
+            for (const auto& p : profiles)
+                total += p.mean_us();
+            const auto flags = out.flags();
+            out << std::fixed << std::setprecision(2);
+            out << std::setw(5) << "index" << "  " << std::setw(12) << "type" << std::setw(22)
+                << "output" << std::setw(12) << "mean us" << std::setw(8) << "%"
+                << std::setw(10) << "GFLOP" << std::setw(10) << "MB" << std::setw(10)
+                << "GFLOP/s" << '\n';
+            std::map<std::string, std::pair<double, double>> per_type;
+            for (const auto& p : profiles)
+            {
+                std::ostringstream shape;
+                shape << p.num_samples << "x" << p.k << "x" << p.nr << "x" << p.nc;
+                const double mean = p.mean_us();
+                out << std::setw(5) << p.index << "  " << std::setw(12) << p.name
+                    << std::setw(22) << shape.str() << std::setw(12) << mean << std::setw(8)
+                    << 100 * mean / total << std::setw(10) << p.flops * 1e-9 << std::setw(10)
+                    << p.bytes / (1 << 20) << std::setw(10)
+                    << (mean > 0 ? p.flops * 1e-3 / mean : 0) << '\n';
+                per_type[p.name].first += mean;
+                per_type[p.name].second += p.flops;
+            }
+            out << "\ntotal per layer type:\n";
+            for (const auto& t : per_type)
+            {
+                out << std::setw(12) << t.first << std::setw(12) << t.second.first << " us"
+                    << std::setw(8) << 100 * t.second.first / total << "%" << std::setw(10)
+                    << t.second.second * 1e-9 << " GFLOP\n";
+            }
+            double forward = 0;
+            for (const auto& p : passes)
+                forward += p.second - p.first;
+            if (not passes.empty())
+            {
+                out << "layers: " << total << " us, forward pass: " << forward / passes.size()
+                    << " us\n";
+            }
+            out.flags(flags);
+        }
+
+        // Writes the replayed layers as complete events of the Chrome trace format, which can
+        // be opened with chrome://tracing or https://ui.perfetto.dev.  The normal forward passes
+        // are on a separate track.
+        void save_chrome_trace(const std::string& path) const
+        {
+            std::ofstream fout(path);
+            if (not fout)
+                throw std::runtime_error("unable to write " + path);
+            fout << std::fixed << std::setprecision(3);
+            fout << "{\"traceEvents\": [\n";
+            bool first = true;
+            for (size_t i = 0; i < passes.size(); ++i)
+            {
+                fout << (first ? "" : ",\n") << "{\"name\": \"forward\", \"cat\": \"pass\", "
+                     << "\"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": " << passes[i].first
+                     << ", \"dur\": " << passes[i].second - passes[i].first
+                     << ", \"args\": {\"pass\": " << i << "}}";
+                first = false;
+            }
+            for (const auto& e : events)
+            {
+                const auto& p = layers.at(e.index);
+                fout << ",\n{\"name\": \"" << p.name << " " << p.index << "\", \"cat\": \""
+                     << p.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": 1, \"ts\": " << e.start
+                     << ", \"dur\": " << e.duration << ", \"args\": {\"index\": " << p.index
+                     << ", \"output\": \"" << p.num_samples << "x" << p.k << "x" << p.nr << "x"
+                     << p.nc << "\", \"gflop\": " << p.flops * 1e-9
+                     << ", \"mb\": " << p.bytes / (1 << 20) << "}}";
+            }
+            fout << "\n]}\n";
+        }
+
+        void clear()
+        {
+            layers.clear();
+            events.clear();
+            passes.clear();
+        }
+
+        private:
+        using clock = std::chrono::steady_clock;
+
+        struct event
+        {
+            size_t index;
+            double start;
+            double duration;
+        };
+
+        double elapsed_us(const clock::time_point t) const
+        {
+            return std::chrono::duration<double, std::micro>(t - start).count();
+        }
+
+        template <typename layer_type>
+        void add_replay(const size_t i, layer_type& l, std::vector<std::function<void()>>& replays)
+        {
+            (void)i;
+            (void)l;
+            (void)replays;
+        }
+
+        template <typename DETAILS, typename SUBNET>
+        void add_replay(
+            const size_t i,
+            add_layer<DETAILS, SUBNET>& l,
+            std::vector<std::function<void()>>& replays)
+        {
+            // layers that sit directly on the input layer can't be replayed on their own
+            if constexpr (detail::has_get_output<std::decay_t<decltype(l.subnet())>>::value)
+                replays.push_back([this, i, &l]() { replay(i, l); });
+        }
+
+        template <typename layer_type> void replay(const size_t i, layer_type& l)
+        {
+            auto& details = l.layer_details();
+            const auto& sub = l.subnet();
+            const auto t0 = clock::now();
+            impl::call_layer_forward(details, sub, scratch);
+            const auto t1 = clock::now();
+            events.push_back({i, elapsed_us(t0), elapsed_us(t1) - elapsed_us(t0)});
+
+            auto& p = layers[i];
+            p.times_us.push_back(events.back().duration);
+            if (p.name.empty())
+            {
+                std::ostringstream sout;
+                sout << details;
+                p.description = sout.str();
+                p.name = p.description.substr(0, p.description.find_first_of("\t ("));
+                p.index = i;
+            }
+            const tensor& in = sub.get_output();
+            const tensor& out = l.get_output();
+            p.num_samples = out.num_samples();
+            p.k = out.k();
+            p.nr = out.nr();
+            p.nc = out.nc();
+            using details_type = std::decay_t<decltype(details)>;
+            double ops_per_output = 1;
+            if constexpr (detail::has_filter_size<details_type>::value)
+            {
+                ops_per_output = details.nr() * details.nc();
+                // convolutions multiply and add every input channel of the window
+                if constexpr (detail::has_num_filters<details_type>::value)
+                    ops_per_output *= 2 * in.k();
+            }
+            p.flops = ops_per_output * out.size();
+            p.bytes = (in.size() + out.size() + details.get_layer_params().size()) * sizeof(float);
+        }
+
+        net_type& net;
+        const clock::time_point start;
+        resizable_tensor input, scratch;
+        std::map<size_t, layer_profile> layers;
+        std::vector<event> events;
+        std::vector<std::pair<double, double>> passes;
+    };
+}  // namespace darknet
+
+#endif  // darknet_profiler_h_INCLUDED
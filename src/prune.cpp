@@ -0,0 +1,105 @@
+#include "eval_utils.h"
+#include "models.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <iomanip>
+
+// Prunes the detector with the gammas and betas of the darknet weights it was converted from,
+// see model_entry::prune, and compares the pruned detector against the original one.
+void prune(
+    const model_entry& model,
+    object_detector& detector,
+    const dlib::command_line_parser& parser)
+{
+    const std::string images_dir = dlib::get_option(parser, "images", "");
+    const size_t num_images = dlib::get_option(parser, "num-images", 100);
+    const long img_size = dlib::get_option(parser, "img-size", 416);
+    const float conf_thresh = dlib::get_option(parser, "conf-thresh", 0.25);
+    const float nms_thresh = dlib::get_option(parser, "nms-thresh", 0.45);
+    model_pruning_options options;
+    options.weights_path = dlib::get_option(parser, "weights", "");
+    options.img_size = img_size;
+    options.flops_ratio = dlib::get_option(parser, "flops", 0.5);
+    options.min_channels_ratio = dlib::get_option(parser, "min-channels", 0.1);
+    if (not (options.flops_ratio > 0 and options.flops_ratio <= 1))
+        throw std::runtime_error("--flops must be in (0, 1]");
+
+    const auto pruned = model.prune(detector, options);
+
+    if (parser.option("save"))
+        pruned->save(parser.option("save").argument());
+    if (parser.option("save-mapped"))
+        pruned->save_mapped(parser.option("save-mapped").argument());
+
+    // compare the pruned network against the original one, whose detections are the reference
+    if (images_dir.empty())
+        return;
+    auto images = load_images(images_dir, num_images);
+    if (images.empty())
+        throw std::runtime_error("no images found in " + images_dir);
+    std::vector<std::vector<detection>> references, detections;
+    const double original_ms =
+        detect_all(detector, images, references, img_size, conf_thresh, nms_thresh);
+    const double pruned_ms =
+        detect_all(*pruned, images, detections, img_size, conf_thresh, nms_thresh);
+    const double map =
+        mean_average_precision(references, detections, detector.get_labels().size());
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "images: " << images.size() << '\n';
+    std::cout << "original: " << original_ms << " ms/image\n";
+    std::cout << "pruned:   " << pruned_ms << " ms/image, speedup " << original_ms / pruned_ms
+              << "x\n";
+    std::cout << "mAP@0.5 of pruned against original: " << 100 * map << "% (drift "
+              << 100 * (1 - map) << "%)\n";
+}
+
+int main(const int argc, const char** argv)
+try
+{
+    dlib::command_line_parser parser;
+    parser.add_option("dnn", "path to a model converted with convert_weights", 1);
+    parser.add_option("fused", "the model given to --dnn was converted with --fused");
+    parser.add_option("weights", "path to the darknet weights the model was converted from", 1);
+    parser.add_option("model", get_model_names() + " (default: yolov4x-mish)", 1);
+    parser.add_option("names", "path to file with label names (one per line)", 1);
+    parser.add_option("flops", "fraction of the convolution FLOPs to keep (default: 0.5)", 1);
+    parser.add_option("min-channels", "fraction of each layer always kept (default: 0.1)", 1);
+    parser.add_option("images", "directory with images to compare the pruned model", 1);
+    parser.add_option("num-images", "max images used from --images (default: 100)", 1);
+    parser.add_option("img-size", "image size to process (default: 416)", 1);
+    parser.add_option("conf-thresh", "confidence threshold (default: 0.25)", 1);
+    parser.add_option("nms-thresh", "non-max suppression threshold (default: 0.45)", 1);
+    parser.add_option("save", "save the pruned network in dlib format", 1);
+    parser.add_option("save-mapped", "save the pruned network in the memory-mappable format", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+
+    if (not parser.option("dnn") or not parser.option("names") or not parser.option("weights"))
+    {
+        std::cout << "Specify the model, the label names and the darknet weights with --dnn, "
+                     "--names and --weights\n";
+        return EXIT_FAILURE;
+    }
+
+    const auto& model = get_model(dlib::get_option(parser, "model", "yolov4x-mish"));
+    const auto detector = model.load(
+        parser.option("dnn").argument(),
+        parser.option("names").argument(),
+        parser.option("fused").count() > 0);
+    prune(model, *detector, parser);
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cout << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,60 @@
+#ifndef prune_model_h_INCLUDED
+#define prune_model_h_INCLUDED
+
+#include "models.h"
+#include "pruning.h"
+#include "weights_visitor.h"
+#include "yolo.h"
+
+// Prunes the network of a detector with the batch normalizations of the darknet weights it was
+// converted from, which are read through the training network of the model.  The layer offset
+// is the one of convert().
+template <typename net_train_type, unsigned int layer_offset, typename net_type>
+std::unique_ptr<object_detector> prune_detector(
+    const yolo_detector<net_type>& detector,
+    const model_pruning_options& options)
+{
+    net_train_type net_train;
+    darknet::setup_detector<net_train_type, layer_offset>(
+        net_train,
+        detector.get_labels().size(),
+        options.img_size);
+    darknet::weights_visitor weights(options.weights_path);
+    dlib::visit_layers_backwards(net_train, weights);
+    weights.check_end();
+
+    darknet::pruning_options pruning;
+    pruning.flops_ratio = options.flops_ratio;
+    pruning.min_channels_ratio = options.min_channels_ratio;
+    auto pruned = std::make_unique<yolo_detector<net_type>>(detector);
+    darknet::channel_pruner pruner(
+        pruned->get_net(),
+        weights.get_bn_gammas(),
+        weights.get_bn_betas(),
+        options.img_size);
+    pruned->get_net() = pruner.prune(pruning);
+    pruner.print_summary(std::cout);
+    std::cout << "params: " << dlib::count_parameters(detector.get_net()) << " -> "
+              << dlib::count_parameters(pruned->get_net()) << '\n';
+    return pruned;
+}
+
+// The prune entry of a model, for its detectors loaded with or without --fused.  It is only
+// included by the translation units of the models, see models.h.
+template <
+    typename net_train_type,
+    unsigned int layer_offset,
+    typename net_infer_type,
+    typename net_fused_type>
+std::unique_ptr<object_detector> prune_model(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    if (const auto* infer = dynamic_cast<const yolo_detector<net_infer_type>*>(&detector))
+        return prune_detector<net_train_type, layer_offset>(*infer, options);
+    if (const auto* fused = dynamic_cast<const yolo_detector<net_fused_type>*>(&detector))
+        return prune_detector<net_train_type, layer_offset>(*fused, options);
+    throw std::runtime_error("the detector to prune is not one of this model");
+}
+
+#endif  // prune_model_h_INCLUDED
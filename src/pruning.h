@@ -0,0 +1,626 @@
+#ifndef darknet_pruning_h_INCLUDED
+#define darknet_pruning_h_INCLUDED
+
+#include "activation_planner.h"
+#include "layers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <dlib/dnn.h>
+#include <iomanip>
+#include <map>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+namespace darknet
+{
+    using namespace dlib;
+
+    namespace detail
+    {
+        template <typename T> struct is_con : std::false_type
+        {
+        };
+        template <long nf, long nr, long nc, int sy, int sx, int py, int px>
+        struct is_con<con_<nf, nr, nc, sy, sx, py, px>> : std::true_type
+        {
+        };
+
+        template <typename T> struct is_concat : std::false_type
+        {
+        };
+        template <template <typename> class... TAGS>
+        struct is_concat<concat_<TAGS...>> : std::true_type
+        {
+        };
+
+        template <typename T> struct is_cascaded_max_pool : std::false_type
+        {
+        };
+        template <long size, long step>
+        struct is_cascaded_max_pool<cascaded_max_pool_<size, step>> : std::true_type
+        {
+        };
+
+        template <typename T> struct is_route_group : std::false_type
+        {
+        };
+        template <long groups, long group_id>
+        struct is_route_group<route_group_<groups, group_id>> : std::true_type
+        {
+        };
+    }  // namespace detail
+
+    struct pruning_options
+    {
+        // fraction of the FLOPs of the convolutions to keep
+        double flops_ratio = 0.5;
+        // fraction of the channels of each convolution that is never pruned
+        double min_channels_ratio = 0.1;
+    };
+
+    // Removes the output channels of the convolutions of an inference network whose batch
+    // normalization has the smallest gammas, as in network slimming, until the FLOPs of the
+    // convolutions fit in a budget.  The channels are ranked over the whole network by the
+    // magnitude of their gamma, which scales the normalized output of the channel, so the
+    // channels with the smallest gammas contribute the least to the next layers.
+    //
+    // The pruner follows the channels of every tensor back to the convolution that produced
+    // them, through the activations, pooling, upsampling and concatenations, so the input
+    // channels of the convolutions and affine layers reading them are removed as well.  The
+    // channels that reach a layer requiring a fixed number of channels, like the residual
+    // additions, the multiplications of the SAM blocks and the splits of the CSP blocks, are
+    // never pruned.
+    //
+    // A removed channel is not zero: it is approximated by the channel with a zero gamma,
+    // whose batch normalization outputs beta everywhere, so the channel outputs the constant
+    // act(beta).  Its contribution to each output of the convolutions reading it, the sum of
+    // the filter weights of the channel times that constant, is folded into the bias of the
+    // output: the beta of the affine layer for the convolutions of the *_infer networks without
+    // a bias, the bias itself otherwise.  It is exact away from the zero-padded borders.
+    //
+    // The convolutions with a batch normalization are those without a bias in the *_infer
+    // networks, and all the fused_con layers of the *_fused ones, in f32 only.  Their gammas
+    // and betas are given in the order of the forward pass, as read by weights_visitor.
+    template <typename net_type> class channel_pruner
+    {
+        public:
+        channel_pruner(
+            net_type& net,
+            const std::vector<matrix<float>>& gammas,
+            const std::vector<matrix<float>>& betas,
+            const long img_size = 416)
+            : net(net), betas(betas)
+        {
+            // the output sizes of the layers give the FLOPs of the convolutions
+            matrix<rgb_pixel> image(img_size, img_size);
+            assign_all_pixels(image, rgb_pixel(0, 0, 0));
+            net(image);
+            visit_layers_backwards(net, [this](size_t i, auto& l) { analyze(i, l); });
+            if (gammas.size() != units.size() or betas.size() != units.size())
+                throw std::runtime_error(
+                    "channel_pruner: " + std::to_string(gammas.size()) + " gammas and " +
+                    std::to_string(betas.size()) + " betas given for " +
+                    std::to_string(units.size()) + " batch normalized convolutions");
+            for (size_t u = 0; u < units.size(); ++u)
+            {
+                if (gammas[u].size() != static_cast<long>(units[u].keep.size()))
+                    throw std::runtime_error(
+                        "channel_pruner: the gammas do not match the convolution " +
+                        std::to_string(u));
+                if (betas[u].size() != gammas[u].size())
+                    throw std::runtime_error(
+                        "channel_pruner: the betas do not match the convolution " +
+                        std::to_string(u));
+                units[u].gamma = gammas[u];
+            }
+            image_size = img_size;
+        }
+
+        // Chooses the channels to keep and returns the pruned network, with the same type.
+        net_type prune(const pruning_options& options)
+        {
+            for (auto& unit : units)
+                std::fill(unit.keep.begin(), unit.keep.end(), true);
+            for (auto& conv : convs)
+            {
+                conv.num_inputs = conv.inputs.size();
+                conv.num_outputs = conv.num_filters;
+            }
+            total_flops = get_flops();
+
+            // the uses of each channel by the convolutions reading it
+            std::map<std::pair<long, long>, std::vector<size_t>> readers;
+            for (size_t c = 0; c < convs.size(); ++c)
+            {
+                for (const auto& source : convs[c].inputs)
+                {
+                    if (source.unit >= 0)
+                        readers[{source.unit, source.channel}].push_back(c);
+                }
+            }
+
+            struct candidate
+            {
+                float gamma;
+                long unit;
+                long channel;
+            };
+            std::vector<candidate> candidates;
+            std::vector<long> num_kept(units.size());
+            for (size_t u = 0; u < units.size(); ++u)
+            {
+                num_kept[u] = units[u].keep.size();
+                if (units[u].locked)
+                    continue;
+                for (long k = 0; k < units[u].gamma.size(); ++k)
+                    candidates.push_back({std::abs(units[u].gamma(k)), long(u), k});
+            }
+            std::sort(
+                candidates.begin(),
+                candidates.end(),
+                [](const candidate& a, const candidate& b) { return a.gamma < b.gamma; });
+
+            double flops = total_flops;
+            const double budget = options.flops_ratio * total_flops;
+            for (const auto& c : candidates)
+            {
+                if (flops <= budget)
+                    break;
+                auto& unit = units[c.unit];
+                const long min_channels = std::max(
+                    1l,
+                    std::lround(std::ceil(options.min_channels_ratio * unit.keep.size())));
+                if (num_kept[c.unit] <= min_channels)
+                    continue;
+                unit.keep[c.channel] = false;
+                --num_kept[c.unit];
+                auto& producer = convs[unit.conv];
+                flops -= producer.flops_per_pair * producer.num_inputs;
+                --producer.num_outputs;
+                for (const size_t r : readers[{c.unit, c.channel}])
+                {
+                    flops -= convs[r].flops_per_pair * convs[r].num_outputs;
+                    --convs[r].num_inputs;
+                }
+            }
+            pruned_flops = flops;
+            return build();
+        }
+
+        // FLOPs of the convolutions, counting a multiply-add as two operations
+        double get_total_flops() const { return total_flops; }
+        double get_pruned_flops() const { return pruned_flops; }
+
+        size_t get_num_units() const { return units.size(); }
+        size_t get_num_locked_units() const
+        {
+            return std::count_if(
+                units.begin(),
+                units.end(),
+                [](const unit_info& u) { return u.locked; });
+        }
+
+        // Prints the channels kept by each convolution that was pruned.
+        void print_summary(std::ostream& out) const
+        {
+            long total = 0, kept = 0;
+            for (size_t u = 0; u < units.size(); ++u)
+            {
+                const auto& keep = units[u].keep;
+                const long n = std::count(keep.begin(), keep.end(), true);
+                total += keep.size();
+                kept += n;
+                if (n < static_cast<long>(keep.size()))
+                {
+                    out << "layer " << std::setw(4) << convs[units[u].conv].index << ": " << n
+                        << " of " << keep.size() << " channels\n";
+                }
+            }
+            const auto flags = out.flags();
+            out << std::fixed << std::setprecision(2) << "channels: " << kept << " of " << total
+                << " kept, " << get_num_locked_units() << " of " << units.size()
+                << " convolutions can't be pruned\n"
+                << "GFLOPs at " << image_size << "x" << image_size << ": " << total_flops * 1e-9
+                << " -> " << pruned_flops * 1e-9 << '\n';
+            out.flags(flags);
+        }
+
+        private:
+        // where a channel of a tensor comes from: a channel of a batch normalized convolution,
+        // or nothing that can be pruned, and the constant the channel holds once its source is
+        // removed
+        struct channel_source
+        {
+            long unit = -1;
+            long channel = 0;
+            float value = 0;
+        };
+        using sources = std::vector<channel_source>;
+
+        struct conv_info
+        {
+            size_t index;  // position of the layer in the network
+            long num_filters;
+            long unit = -1;
+            sources inputs;
+            double flops_per_pair;  // for each pair of input and output channels
+            long num_inputs = 0, num_outputs = 0;
+        };
+
+        struct unit_info
+        {
+            size_t conv;
+            matrix<float> gamma;
+            std::vector<bool> keep;
+            bool locked = false;
+        };
+
+        // input and output channels kept by the layers whose parameters are pruned
+        struct layer_plan
+        {
+            sources input_sources;
+            std::vector<bool> inputs;
+            std::vector<bool> outputs;
+        };
+
+        const sources& get_sources(const tensor& t)
+        {
+            auto& s = tensor_sources[&t];
+            // the input of the network, or a tensor produced before the first analyzed layer
+            if (s.size() != static_cast<size_t>(t.k()))
+                s.assign(t.k(), channel_source());
+            return s;
+        }
+
+        void lock(const sources& s)
+        {
+            for (const auto& source : s)
+            {
+                if (source.unit >= 0)
+                    units[source.unit].locked = true;
+            }
+        }
+
+        template <typename layer_type> void analyze(size_t, layer_type&) {}
+
+        template <typename DETAILS, typename SUBNET, typename E>
+        void analyze(const size_t i, add_layer<DETAILS, SUBNET, E>& l)
+        {
+            auto& details = l.layer_details();
+            const tensor& output = l.get_output();
+            sources input;
+            if constexpr (detail::has_output<std::decay_t<decltype(l.subnet())>>::value)
+                input = get_sources(l.subnet().get_output());
+            else
+                input.assign(input_channels(details), channel_source());
+
+            if constexpr (detail::is_con<DETAILS>::value or is_fused_con<DETAILS>::value)
+            {
+                conv_info conv;
+                conv.index = i;
+                conv.num_filters = output.k();
+                conv.inputs = input;
+                conv.flops_per_pair =
+                    2. * details.nr() * details.nc() * output.nr() * output.nc();
+                bool normalized = true;
+                if constexpr (detail::is_con<DETAILS>::value)
+                    normalized = details.bias_is_disabled();
+                if constexpr (is_fused_con<DETAILS>::value)
+                {
+                    if (details.get_precision() != fused_precision::f32)
+                        throw std::runtime_error("channel_pruner: fused_con must be in f32");
+                }
+                sources out(output.k());
+                if (normalized)
+                {
+                    conv.unit = units.size();
+                    units.push_back({convs.size(), {}, std::vector<bool>(output.k(), true)});
+                    // a channel with a zero gamma: its batch normalization gives beta, which
+                    // goes through the activation of the fused_con layers and through the
+                    // next layers in the *_infer networks.  The constructor checks the sizes.
+                    const bool has_beta = conv.unit < static_cast<long>(betas.size()) and
+                                          betas[conv.unit].size() == output.k();
+                    for (long k = 0; k < output.k(); ++k)
+                    {
+                        float beta = has_beta ? betas[conv.unit](k) : 0;
+                        if constexpr (is_fused_con<DETAILS>::value)
+                            beta = details.activate(beta);
+                        out[k] = {conv.unit, k, beta};
+                    }
+                }
+                plans[i].input_sources = input;
+                convs.push_back(std::move(conv));
+                tensor_sources[&output] = std::move(out);
+            }
+            else if constexpr (std::is_same<DETAILS, affine_>::value)
+            {
+                plans[i].input_sources = input;
+                tensor_sources[&output] = input;
+            }
+            else if constexpr (detail::is_concat<DETAILS>::value or is_route<DETAILS>::value)
+            {
+                std::vector<const tensor*> tagged;
+                detail::tagged_inputs<DETAILS>::get(l.subnet(), tagged);
+                sources out;
+                for (const auto* t : tagged)
+                {
+                    const auto& s = get_sources(*t);
+                    out.insert(out.end(), s.begin(), s.end());
+                }
+                tensor_sources[&output] = std::move(out);
+            }
+            else if constexpr (detail::is_cascaded_max_pool<DETAILS>::value)
+            {
+                // the smaller pool it reads has the channels of the input of the spp block
+                tensor_sources[&output] = input;
+            }
+            else if constexpr (detail::is_route_group<DETAILS>::value)
+            {
+                // the groups must keep the same size
+                lock(input);
+                const long k = output.k();
+                tensor_sources[&output] = sources(
+                    input.begin() + details.group_id() * k,
+                    input.begin() + (details.group_id() + 1) * k);
+            }
+            else
+            {
+                if (details.get_layer_params().size() != 0)
+                {
+                    std::ostringstream sout;
+                    sout << details;
+                    throw std::runtime_error("channel_pruner: unsupported layer " + sout.str());
+                }
+                // the layers combining their inputs channel by channel need them to match
+                std::vector<const tensor*> tagged;
+                detail::tagged_inputs<DETAILS>::get(l.subnet(), tagged);
+                if (not tagged.empty())
+                {
+                    lock(input);
+                    for (const auto* t : tagged)
+                        lock(get_sources(*t));
+                }
+                if (output.k() == static_cast<long>(input.size()))
+                {
+                    sources out = input;
+                    for (auto& source : out)
+                        source.value = activate(details, source.value);
+                    tensor_sources[&output] = std::move(out);
+                }
+                else
+                {
+                    lock(input);
+                    tensor_sources[&output] = sources(output.k());
+                }
+            }
+        }
+
+        // the value of a constant channel after a layer that keeps the number of channels: the
+        // activations change it, the pooling and upsampling layers keep it
+        template <typename DETAILS> static float activate(const DETAILS& details, const float x)
+        {
+            if constexpr (std::is_same<DETAILS, leaky_relu_>::value)
+                return x > 0 ? x : details.get_alpha() * x;
+            else if constexpr (std::is_same<DETAILS, relu_>::value)
+                return std::max(x, 0.f);
+            else if constexpr (
+                std::is_same<DETAILS, mish_>::value or std::is_same<DETAILS, fast_mish_>::value)
+                return mish_exact(x);
+            else if constexpr (std::is_same<DETAILS, sig_>::value)
+                return 1 / (1 + std::exp(-x));
+            else
+                return x;
+        }
+
+        template <typename DETAILS> static long input_channels(const DETAILS& details)
+        {
+            if constexpr (detail::is_con<DETAILS>::value)
+            {
+                const long num_biases = details.bias_is_disabled() ? 0 : details.num_filters();
+                return (details.get_layer_params().size() - num_biases) / details.num_filters() /
+                       details.nr() / details.nc();
+            }
+            else if constexpr (is_fused_con<DETAILS>::value)
+            {
+                return details.num_inputs();
+            }
+            else
+            {
+                return 0;
+            }
+        }
+
+        double get_flops() const
+        {
+            double flops = 0;
+            for (const auto& conv : convs)
+                flops += conv.flops_per_pair * conv.num_inputs * conv.num_outputs;
+            return flops;
+        }
+
+        std::vector<bool> get_mask(const sources& s) const
+        {
+            std::vector<bool> mask(s.size(), true);
+            for (size_t k = 0; k < s.size(); ++k)
+            {
+                if (s[k].unit >= 0)
+                    mask[k] = units[s[k].unit].keep[s[k].channel];
+            }
+            return mask;
+        }
+
+        net_type build()
+        {
+            std::vector<void*> layers(net_type::num_layers, nullptr);
+            visit_layers(net, [&](size_t i, auto& l) { layers[i] = &l; });
+            for (auto& p : plans)
+                p.second.inputs = get_mask(p.second.input_sources);
+            for (const auto& conv : convs)
+            {
+                auto& p = plans[conv.index];
+                if (conv.unit >= 0)
+                    p.outputs = units[conv.unit].keep;
+                else
+                    p.outputs.assign(conv.num_filters, true);
+            }
+
+            // A new network is set up with the sizes of the pruned layers and the settings of
+            // the other ones, then the kept parameters are copied.  Both networks have the same
+            // type, so the layer at a given index has the same type in both.
+            net_type pruned;
+            input_layer(pruned) = input_layer(net);
+            visit_layers(
+                pruned,
+                [&](size_t i, auto& l)
+                {
+                    using layer_type = std::decay_t<decltype(l)>;
+                    configure(i, l, *static_cast<layer_type*>(layers[i]));
+                });
+            matrix<rgb_pixel> image(image_size, image_size);
+            assign_all_pixels(image, rgb_pixel(0, 0, 0));
+            pruned(image);
+            // from the input, so a convolution is copied before the affine layer reading it
+            bias_shifts.clear();
+            visit_layers_backwards(
+                pruned,
+                [&](size_t i, auto& l)
+                {
+                    using layer_type = std::decay_t<decltype(l)>;
+                    copy_parameters(i, l, *static_cast<layer_type*>(layers[i]));
+                });
+            pruned.clean();
+            return pruned;
+        }
+
+        template <typename layer_type> void configure(size_t, layer_type&, const layer_type&) {}
+
+        template <typename DETAILS, typename SUBNET, typename E>
+        void configure(
+            const size_t i,
+            add_layer<DETAILS, SUBNET, E>& l,
+            const add_layer<DETAILS, SUBNET, E>& original)
+        {
+            const auto& details = original.layer_details();
+            if constexpr (detail::is_con<DETAILS>::value)
+            {
+                const auto& outputs = plans.at(i).outputs;
+                DETAILS con(num_con_outputs(std::count(outputs.begin(), outputs.end(), true)));
+                if (details.bias_is_disabled())
+                    con.disable_bias();
+                l.layer_details() = con;
+            }
+            else if constexpr (is_fused_con<DETAILS>::value)
+            {
+                const auto& outputs = plans.at(i).outputs;
+                DETAILS con;
+                con.set_num_filters(std::count(outputs.begin(), outputs.end(), true));
+                l.layer_details() = con;
+            }
+            else
+            {
+                // the parameters of the affine layers are allocated again by their setup
+                l.layer_details() = details;
+            }
+        }
+
+        template <typename layer_type> void copy_parameters(size_t, layer_type&, const layer_type&)
+        {
+        }
+
+        template <typename DETAILS, typename SUBNET, typename E>
+        void copy_parameters(
+            const size_t i,
+            add_layer<DETAILS, SUBNET, E>& l,
+            const add_layer<DETAILS, SUBNET, E>& original)
+        {
+            const auto p = plans.find(i);
+            if (p == plans.end())
+                return;
+            const auto& details = original.layer_details();
+            const float* src = details.get_layer_params().host();
+            float* dst = l.layer_details().get_layer_params().host();
+            if constexpr (std::is_same<DETAILS, affine_>::value)
+            {
+                // gammas followed by betas, one per channel
+                const auto& keep = p->second.inputs;
+                for (const long offset : {0l, static_cast<long>(keep.size())})
+                {
+                    for (size_t k = 0; k < keep.size(); ++k)
+                    {
+                        if (keep[k])
+                            *dst++ = src[offset + k];
+                    }
+                }
+                // the shifts of the convolution below, scaled by the gammas
+                const auto shifts = bias_shifts.find(i + 1);
+                if (shifts != bias_shifts.end())
+                {
+                    float* const gammas = l.layer_details().get_layer_params().host();
+                    float* const betas = gammas + shifts->second.size();
+                    for (size_t o = 0; o < shifts->second.size(); ++o)
+                        betas[o] += gammas[o] * shifts->second[o];
+                }
+            }
+            else
+            {
+                // filters of num_filters x num_inputs x nr x nc, followed by the biases
+                const auto& inputs = p->second.inputs;
+                const auto& input_sources = p->second.input_sources;
+                const auto& outputs = p->second.outputs;
+                const long plane = details.nr() * details.nc();
+                const long filter_size = inputs.size() * plane;
+                // what the removed input channels added to each kept output
+                std::vector<float> shifts;
+                for (size_t o = 0; o < outputs.size(); ++o)
+                {
+                    if (not outputs[o])
+                        continue;
+                    float shift = 0;
+                    for (size_t k = 0; k < inputs.size(); ++k)
+                    {
+                        const float* const w = src + o * filter_size + k * plane;
+                        if (inputs[k])
+                            dst = std::copy_n(w, plane, dst);
+                        else
+                            shift += input_sources[k].value * std::accumulate(w, w + plane, 0.f);
+                    }
+                    shifts.push_back(shift);
+                }
+                bool has_biases = true;
+                if constexpr (detail::is_con<DETAILS>::value)
+                    has_biases = not details.bias_is_disabled();
+                if (has_biases)
+                {
+                    const float* biases = src + outputs.size() * filter_size;
+                    for (size_t o = 0, j = 0; o < outputs.size(); ++o)
+                    {
+                        if (outputs[o])
+                            *dst++ = biases[o] + shifts[j++];
+                    }
+                }
+                else
+                {
+                    bias_shifts[i] = std::move(shifts);
+                }
+            }
+        }
+
+        net_type& net;
+        std::vector<matrix<float>> betas;
+        long image_size = 416;
+        std::vector<conv_info> convs;
+        std::vector<unit_info> units;
+        std::map<const tensor*, sources> tensor_sources;
+        std::map<size_t, layer_plan> plans;
+        // the shifts of the outputs of the convolutions without a bias, for their affine layer
+        std::map<size_t, std::vector<float>> bias_shifts;
+        double total_flops = 0;
+        double pruned_flops = 0;
+    };
+}  // namespace darknet
+
+#endif  // darknet_pruning_h_INCLUDED
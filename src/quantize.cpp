@@ -0,0 +1,104 @@
+#include "eval_utils.h"
+#include "models.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <iomanip>
+
+// Calibrates the fused network of the detector on the calibration images, quantizes it to
+// int8 and compares the quantized detector against the float one.
+void quantize(object_detector& detector, const dlib::command_line_parser& parser)
+{
+    const std::string calibration_dir = dlib::get_option(parser, "calibration", "");
+    const std::string images_dir = dlib::get_option(parser, "images", calibration_dir);
+    const size_t num_images = dlib::get_option(parser, "num-images", 100);
+    const input_size img_size = parse_input_size(dlib::get_option(parser, "img-size", "416"));
+    const float conf_thresh = dlib::get_option(parser, "conf-thresh", 0.25);
+    const float nms_thresh = dlib::get_option(parser, "nms-thresh", 0.45);
+
+    // calibration: record the input range of every layer with the float network
+    auto calibration_images = load_images(calibration_dir, num_images);
+    if (calibration_images.empty())
+        throw std::runtime_error("no calibration images found in " + calibration_dir);
+    std::cout << "calibrating with " << calibration_images.size() << " images\n";
+    // the detections of the calibration pass are not used
+    std::vector<std::vector<detection>> scratch;
+    detector.set_calibrating(true);
+    detect_all(detector, calibration_images, scratch, img_size, conf_thresh, nms_thresh);
+    detector.set_calibrating(false);
+
+    auto quantized = detector.clone();
+    const size_t num_layers = quantized->quantize_int8();
+    if (num_layers == 0)
+        throw std::runtime_error("no layer to quantize, convert the model with --fused");
+    std::cout << "quantized " << num_layers << " layers to int8\n";
+
+    // compare the quantized network against the float one, whose detections are the reference
+    auto images = images_dir == calibration_dir ? std::move(calibration_images)
+                                                : load_images(images_dir, num_images);
+    if (images.empty())
+        throw std::runtime_error("no images found in " + images_dir);
+    std::vector<std::vector<detection>> references, detections;
+    const double float_ms =
+        detect_all(detector, images, references, img_size, conf_thresh, nms_thresh);
+    const double int8_ms =
+        detect_all(*quantized, images, detections, img_size, conf_thresh, nms_thresh);
+    const double map =
+        mean_average_precision(references, detections, detector.get_labels().size());
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "images: " << images.size() << '\n';
+    std::cout << "f32:  " << float_ms << " ms/image\n";
+    std::cout << "int8: " << int8_ms << " ms/image, speedup " << float_ms / int8_ms << "x\n";
+    std::cout << "mAP@0.5 of int8 against f32: " << 100 * map << "% (drift " << 100 * (1 - map)
+              << "%)\n";
+
+    if (parser.option("save"))
+        quantized->save(parser.option("save").argument());
+}
+
+int main(const int argc, const char** argv)
+try
+{
+    dlib::command_line_parser parser;
+    parser.add_option("dnn", "path to a model converted with convert_weights --fused", 1);
+    parser.add_option("model", get_model_names() + " (default: yolov4x-mish)", 1);
+    parser.add_option("names", "path to file with label names (one per line)", 1);
+    parser.add_option("calibration", "directory with representative images for calibration", 1);
+    parser.add_option("images", "directory with images to compare (default: --calibration)", 1);
+    parser.add_option("num-images", "max images used from each directory (default: 100)", 1);
+    parser.add_option("img-size", "image size to process, N or WxH (default: 416)", 1);
+    parser.add_option("conf-thresh", "confidence threshold (default: 0.25)", 1);
+    parser.add_option("nms-thresh", "non-max suppression threshold (default: 0.45)", 1);
+    parser.add_option("save", "save the quantized network in dlib format", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+
+    if (not parser.option("dnn") or not parser.option("names") or
+        not parser.option("calibration"))
+    {
+        std::cout << "Specify the model, the label names and the calibration images with "
+                     "--dnn, --names and --calibration\n";
+        return EXIT_FAILURE;
+    }
+
+    const auto& model = get_model(dlib::get_option(parser, "model", "yolov4x-mish"));
+    const auto detector = model.load(
+        parser.option("dnn").argument(),
+        parser.option("names").argument(),
+        true);
+    quantize(*detector, parser);
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cout << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+#ifndef darknet_quantized_conv_h_INCLUDED
+#define darknet_quantized_conv_h_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Building blocks of the INT8 convolution used by fused_con_.  Weights and activations are
+// quantized symmetrically to [-127, 127] and stored as int16, so the products can be summed
+// in pairs with madd into int32 without saturating.  The reduction dimension (input channels
+// times filter size) is padded to a multiple of quantized_k_block so the kernels never need a
+// remainder loop.
+namespace darknet
+{
+    constexpr long quantized_k_block = 16;
+
+    inline long pad_quantized_k(const long k)
+    {
+        return (k + quantized_k_block - 1) / quantized_k_block * quantized_k_block;
+    }
+
+    inline int16_t quantize_value(const float x, const float inv_scale)
+    {
+        const float v = std::max(-127.f, std::min(127.f, x * inv_scale));
+        return static_cast<int16_t>(std::lround(v));
+    }
+
+    // Quantizes each of the num_rows rows of size k with its own scale, the largest magnitude in
+    // the row maps to 127.  The rows of q are padded with zeros to pad_quantized_k(k).
+    inline void quantize_rows(
+        const float* data,
+        const long num_rows,
+        const long k,
+        std::vector<int16_t>& q,
+        std::vector<float>& scales)
+    {
+        const long kp = pad_quantized_k(k);
+        q.assign(num_rows * kp, 0);
+        scales.resize(num_rows);
+        for (long r = 0; r < num_rows; ++r)
+        {
+            const float* row = data + r * k;
+            float max_abs = 0;
+            for (long i = 0; i < k; ++i)
+                max_abs = std::max(max_abs, std::abs(row[i]));
+            scales[r] = max_abs > 0 ? max_abs / 127 : 1;
+            const float inv_scale = 1 / scales[r];
+            for (long i = 0; i < k; ++i)
+                q[r * kp + i] = quantize_value(row[i], inv_scale);
+        }
+    }
+
+    // Copies the receptive fields of the output pixels [p_begin, p_end) of a quantized image
+    // with k channels into consecutive rows of kp values, in the (channel, row, column) order of
+    // the filters.  Pixels that fall in the padding are zero.
+    inline void quantized_im2col(
+        const int16_t* image,
+        const long k,
+        const long nr,
+        const long nc,
+        const long filter_nr,
+        const long filter_nc,
+        const long stride_y,
+        const long stride_x,
+        const long padding_y,
+        const long padding_x,
+        const long out_nc,
+        const long p_begin,
+        const long p_end,
+        int16_t* cols)
+    {
+        const long kp = pad_quantized_k(k * filter_nr * filter_nc);
+        for (long p = p_begin; p < p_end; ++p, cols += kp)
+        {
+            const long y0 = (p / out_nc) * stride_y - padding_y;
+            const long x0 = (p % out_nc) * stride_x - padding_x;
+            int16_t* col = cols;
+            for (long c = 0; c < k; ++c)
+            {
+                const int16_t* channel = image + c * nr * nc;
+                for (long fy = 0; fy < filter_nr; ++fy)
+                {
+                    const long y = y0 + fy;
+                    for (long fx = 0; fx < filter_nc; ++fx)
+                    {
+                        const long x = x0 + fx;
+                        *col++ = (y >= 0 and y < nr and x >= 0 and x < nc) ? channel[y * nc + x]
+                                                                            : 0;
+                    }
+                }
+            }
+            std::fill(col, cols + kp, 0);
+        }
+    }
+
+#if defined(__AVX2__)
+    inline int32_t horizontal_sum(const __m256i v)
+    {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+#endif
+
+    inline int32_t quantized_dot(const int16_t* a, const int16_t* b, const long kp)
+    {
+#if defined(__AVX2__)
+        __m256i acc = _mm256_setzero_si256();
+        for (long i = 0; i < kp; i += 16)
+        {
+            const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+        }
+        return horizontal_sum(acc);
+#elif defined(__SSE2__)
+        __m128i acc = _mm_setzero_si128();
+        for (long i = 0; i < kp; i += 8)
+        {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(acc);
+#else
+        int32_t acc = 0;
+        for (long i = 0; i < kp; ++i)
+            acc += static_cast<int32_t>(a[i]) * b[i];
+        return acc;
+#endif
+    }
+
+    // out[o * ldo + p] = dot(weights row o, cols row p) for num_out weight rows and num_cols
+    // columns.  With AVX2, blocks of 4 filters by 2 columns share their loads.
+    inline void quantized_gemm(
+        const int16_t* weights,
+        const long num_out,
+        const int16_t* cols,
+        const long num_cols,
+        const long kp,
+        int32_t* out,
+        const long ldo)
+    {
+        long o = 0;
+#if defined(__AVX2__)
+        for (; o + 4 <= num_out; o += 4)
+        {
+            const int16_t* w0 = weights + o * kp;
+            long p = 0;
+            for (; p + 2 <= num_cols; p += 2)
+            {
+                const int16_t* c0 = cols + p * kp;
+                __m256i acc[4][2];
+                for (auto& row : acc)
+                    row[0] = row[1] = _mm256_setzero_si256();
+                for (long i = 0; i < kp; i += 16)
+                {
+                    const __m256i x0 =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+                    const __m256i x1 =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + kp + i));
+                    for (int j = 0; j < 4; ++j)
+                    {
+                        const __m256i w = _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(w0 + j * kp + i));
+                        acc[j][0] = _mm256_add_epi32(acc[j][0], _mm256_madd_epi16(w, x0));
+                        acc[j][1] = _mm256_add_epi32(acc[j][1], _mm256_madd_epi16(w, x1));
+                    }
+                }
+                for (int j = 0; j < 4; ++j)
+                {
+                    out[(o + j) * ldo + p] = horizontal_sum(acc[j][0]);
+                    out[(o + j) * ldo + p + 1] = horizontal_sum(acc[j][1]);
+                }
+            }
+            for (; p < num_cols; ++p)
+            {
+                for (int j = 0; j < 4; ++j)
+                    out[(o + j) * ldo + p] = quantized_dot(w0 + j * kp, cols + p * kp, kp);
+            }
+        }
+#endif
+        for (; o < num_out; ++o)
+        {
+            for (long p = 0; p < num_cols; ++p)
+                out[o * ldo + p] = quantized_dot(weights + o * kp, cols + p * kp, kp);
+        }
+    }
+}  // namespace darknet
+
+#endif  // darknet_quantized_conv_h_INCLUDED
@@ -0,0 +1,229 @@
+#ifndef request_batcher_h_INCLUDED
+#define request_batcher_h_INCLUDED
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Settings of request_batcher.
+struct batching_options
+{
+    // most requests processed at once
+    size_t max_batch_size = 8;
+    // longest time the oldest request waits for more requests to fill its batch
+    std::chrono::microseconds max_delay{5000};
+    // most requests waiting in the queue, the next ones are rejected until it drains
+    size_t max_queue_size = 64;
+};
+
+// Counters of a request_batcher since it started, the latencies are in milliseconds and their
+// percentiles are computed over the last requests.
+struct batching_stats
+{
+    size_t queue_depth = 0;
+    size_t max_queue_depth = 0;
+    long completed = 0;
+    long rejected = 0;
+    long batches = 0;
+    double mean_batch_size = 0;
+    double mean_queue_ms = 0;  // from the submission to the start of the batch
+    double mean_latency_ms = 0;  // from the submission to the result
+    double p50_latency_ms = 0;
+    double p99_latency_ms = 0;
+};
+
+// Collects the requests submitted concurrently by several threads into batches, which a single
+// worker thread processes with one call.  A batch starts once it is full or once its oldest
+// request has waited for the max delay, so a lone request is only delayed by that much.  The
+// queue is bounded: try_submit() rejects the requests while it is full, which lets the callers
+// push back on their clients instead of piling up latency.
+template <typename request_type, typename result_type> class request_batcher
+{
+    public:
+    using clock = std::chrono::steady_clock;
+    // processes the requests of a batch and stores the result of requests[i] in results[i]
+    using process_function =
+        std::function<void(std::vector<request_type>&, std::vector<result_type>&)>;
+
+    request_batcher(process_function process, const batching_options& options)
+        : process(std::move(process)), options(options)
+    {
+        if (options.max_batch_size == 0 or options.max_queue_size == 0)
+            throw std::runtime_error("the max batch size and queue size must be positive");
+        worker = std::thread([this] { run(); });
+    }
+
+    request_batcher(const request_batcher&) = delete;
+    request_batcher& operator=(const request_batcher&) = delete;
+
+    // processes the requests still queued and stops the worker
+    ~request_batcher()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    // Queues a request and gives the future of its result, which holds the exception thrown by
+    // the processing if it failed.  Returns false without queueing the request when the queue
+    // is full.
+    bool try_submit(request_type request, std::future<result_type>& result)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (stopping or queue.size() >= options.max_queue_size)
+            {
+                ++rejected;
+                return false;
+            }
+            queue.push_back(pending{std::move(request), {}, clock::now()});
+            result = queue.back().promise.get_future();
+            max_queue_depth = std::max(max_queue_depth, queue.size());
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    const batching_options& get_options() const { return options; }
+
+    batching_stats get_stats() const
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        batching_stats stats;
+        stats.queue_depth = queue.size();
+        stats.max_queue_depth = max_queue_depth;
+        stats.completed = completed;
+        stats.rejected = rejected;
+        stats.batches = batches;
+        if (batches > 0)
+            stats.mean_batch_size = static_cast<double>(completed) / batches;
+        if (completed > 0)
+        {
+            stats.mean_queue_ms = queue_ms / completed;
+            stats.mean_latency_ms = latency_ms / completed;
+        }
+        auto latencies = recent_latencies;
+        stats.p50_latency_ms = percentile(latencies, 0.5);
+        stats.p99_latency_ms = percentile(latencies, 0.99);
+        return stats;
+    }
+
+    private:
+    struct pending
+    {
+        request_type request;
+        std::promise<result_type> promise;
+        clock::time_point submitted;
+    };
+
+    void run()
+    {
+        std::vector<pending> batch;
+        std::vector<request_type> requests;
+        std::vector<result_type> results;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping or not queue.empty(); });
+                if (queue.empty())
+                    return;
+                const auto deadline = queue.front().submitted + options.max_delay;
+                cv.wait_until(
+                    lock,
+                    deadline,
+                    [this] { return stopping or queue.size() >= options.max_batch_size; });
+                const size_t size = std::min(queue.size(), options.max_batch_size);
+                batch.clear();
+                for (size_t i = 0; i < size; ++i)
+                {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+
+            const auto start = clock::now();
+            requests.clear();
+            for (auto& p : batch)
+                requests.push_back(std::move(p.request));
+            results.clear();
+            std::exception_ptr error;
+            try
+            {
+                process(requests, results);
+                if (results.size() != requests.size())
+                    throw std::runtime_error("the batch gave a wrong number of results");
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            const auto stop = clock::now();
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                if (error)
+                    batch[i].promise.set_exception(error);
+                else
+                    batch[i].promise.set_value(std::move(results[i]));
+            }
+
+            const std::lock_guard<std::mutex> lock(mutex);
+            ++batches;
+            for (const auto& p : batch)
+            {
+                const double latency = to_ms(stop - p.submitted);
+                queue_ms += to_ms(start - p.submitted);
+                latency_ms += latency;
+                if (recent_latencies.size() < num_recent)
+                    recent_latencies.push_back(latency);
+                else
+                    recent_latencies[completed % num_recent] = latency;
+                ++completed;
+            }
+        }
+    }
+
+    static double to_ms(const clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    static double percentile(std::vector<double>& values, const double p)
+    {
+        if (values.empty())
+            return 0;
+        const auto nth = values.begin() + static_cast<long>(p * (values.size() - 1));
+        std::nth_element(values.begin(), nth, values.end());
+        return *nth;
+    }
+
+    static constexpr size_t num_recent = 1024;
+
+    process_function process;
+    batching_options options;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<pending> queue;
+    bool stopping = false;
+    size_t max_queue_depth = 0;
+    long completed = 0;
+    long rejected = 0;
+    long batches = 0;
+    double queue_ms = 0;
+    double latency_ms = 0;
+    std::vector<double> recent_latencies;
+    std::thread worker;
+};
+
+#endif  // request_batcher_h_INCLUDED
@@ -0,0 +1,208 @@
+#include "models.h"
+#include "request_batcher.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <dlib/opencv.h>
+#include <dlib/server.h>
+#include <opencv2/imgcodecs.hpp>
+
+using image_type = dlib::matrix<dlib::rgb_pixel>;
+
+// Decodes an image encoded in any format OpenCV reads, e.g. JPEG or PNG.
+image_type decode_image(const std::string& data)
+{
+    const int size = data.size();
+    const cv::Mat buffer(1, size, CV_8UC1, const_cast<char*>(data.data()));
+    const cv::Mat mat = cv::imdecode(buffer, cv::IMREAD_COLOR);
+    if (mat.empty())
+        throw std::runtime_error("the request body is not an image");
+    image_type image;
+    dlib::assign_image(image, dlib::cv_image<dlib::bgr_pixel>(mat));
+    return image;
+}
+
+std::string json_escape(const std::string& text)
+{
+    std::ostringstream sout;
+    for (const char c : text)
+    {
+        if (c == '"' or c == '\\')
+            sout << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            sout << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            sout << c;
+    }
+    return sout.str();
+}
+
+// The boxes are normalized to the image size, with their center in x and y.
+std::string to_json(
+    const std::vector<detection>& detections,
+    const std::vector<std::string>& labels,
+    const long width,
+    const long height)
+{
+    std::ostringstream sout;
+    sout << "{\"width\":" << width << ",\"height\":" << height << ",\"detections\":[";
+    for (size_t i = 0; i < detections.size(); ++i)
+    {
+        const auto& d = detections[i];
+        sout << (i > 0 ? "," : "") << "{\"label\":\"" << json_escape(get_label(d, labels))
+             << "\",\"id\":" << d.id << ",\"score\":" << d.score << ",\"x\":" << d.x
+             << ",\"y\":" << d.y << ",\"w\":" << d.w << ",\"h\":" << d.h << '}';
+    }
+    sout << "]}\n";
+    return sout.str();
+}
+
+std::string to_json(const batching_stats& s)
+{
+    std::ostringstream sout;
+    sout << std::fixed << std::setprecision(3) << "{\"queue_depth\":" << s.queue_depth
+         << ",\"max_queue_depth\":" << s.max_queue_depth << ",\"completed\":" << s.completed
+         << ",\"rejected\":" << s.rejected << ",\"batches\":" << s.batches
+         << ",\"mean_batch_size\":" << s.mean_batch_size << ",\"mean_queue_ms\":"
+         << s.mean_queue_ms << ",\"mean_latency_ms\":" << s.mean_latency_ms
+         << ",\"p50_latency_ms\":" << s.p50_latency_ms << ",\"p99_latency_ms\":"
+         << s.p99_latency_ms << "}\n";
+    return sout.str();
+}
+
+// Serves the detector over HTTP: POST /detect takes an encoded image as its body and returns
+// the detections as JSON, GET /stats returns the batching counters.  Each connection has its
+// own thread, which decodes its image and waits for the batch the image is part of, while a
+// single detector runs the batches.  The requests that find the queue full get a 503.
+class detection_server : public dlib::server_http
+{
+    public:
+    detection_server(
+        object_detector& detector,
+        const input_size img_size,
+        const float conf_thresh,
+        const float nms_thresh,
+        const batching_options& options)
+        : labels(detector.get_labels()),
+          batcher(
+              [&detector, img_size, conf_thresh, nms_thresh](
+                  std::vector<image_type>& images,
+                  std::vector<std::vector<detection>>& detections)
+              { detector.detect_batch(images, detections, img_size, conf_thresh, nms_thresh); },
+              options)
+    {
+    }
+
+    private:
+    const std::string on_request(const dlib::incoming_things& in, dlib::outgoing_things& out)
+    {
+        out.headers["Content-Type"] = "application/json";
+        try
+        {
+            if (in.path == "/detect" and in.request_type == "POST")
+            {
+                auto image = decode_image(in.body);
+                const long width = image.nc(), height = image.nr();
+                std::future<std::vector<detection>> result;
+                if (not batcher.try_submit(std::move(image), result))
+                {
+                    out.http_return = 503;
+                    out.http_return_status = "Service Unavailable";
+                    out.headers["Retry-After"] = "1";
+                    return "{\"error\":\"the queue is full\"}\n";
+                }
+                return to_json(result.get(), labels, width, height);
+            }
+            if (in.path == "/stats" and in.request_type == "GET")
+                return to_json(batcher.get_stats());
+            out.http_return = 404;
+            out.http_return_status = "Not Found";
+            return "{\"error\":\"use POST /detect or GET /stats\"}\n";
+        }
+        catch (const std::exception& e)
+        {
+            out.http_return = 500;
+            out.http_return_status = "Internal Server Error";
+            return "{\"error\":\"" + json_escape(e.what()) + "\"}\n";
+        }
+    }
+
+    const std::vector<std::string> labels;
+    request_batcher<image_type, std::vector<detection>> batcher;
+};
+
+void serve(const dlib::command_line_parser& parser)
+{
+    const std::string dnn_path = dlib::get_option(parser, "dnn", "");
+    const std::string names_path = dlib::get_option(parser, "names", "");
+    const std::string model = dlib::get_option(parser, "model", "yolov4x-mish");
+    const bool fused = parser.option("fused").count() > 0;
+    const input_size img_size = parse_input_size(dlib::get_option(parser, "img-size", "416"));
+    const float conf_thresh = dlib::get_option(parser, "conf-thresh", 0.25);
+    const float nms_thresh = dlib::get_option(parser, "nms-thresh", 0.45);
+    const long max_batch_size = dlib::get_option(parser, "max-batch-size", 8);
+    const long max_queue_size = dlib::get_option(parser, "max-queue-size", 64);
+    const double max_delay = dlib::get_option(parser, "max-delay", 5.0);
+    if (max_batch_size < 1 or max_queue_size < 1 or max_delay < 0)
+        throw std::runtime_error("the batch size, queue size and delay must be positive");
+    batching_options options;
+    options.max_batch_size = max_batch_size;
+    options.max_queue_size = max_queue_size;
+    options.max_delay = std::chrono::microseconds(std::lround(1000 * max_delay));
+
+    const auto detector = get_model(model).load(dnn_path, names_path, fused);
+    detector->set_letterbox(parser.option("letterbox").count() > 0);
+    detector->set_memory_planning(parser.option("plan-memory").count() > 0);
+
+    detection_server server(*detector, img_size, conf_thresh, nms_thresh, options);
+    const int port = dlib::get_option(parser, "port", 8080);
+    server.set_listening_ip("127.0.0.1");
+    server.set_listening_port(port);
+    server.set_max_content_length(dlib::get_option(parser, "max-body", 16ul) << 20);
+    std::cout << "listening on http://127.0.0.1:" << port << " (POST /detect, GET /stats)\n";
+    server.start();
+}
+
+int main(const int argc, const char** argv)
+try
+{
+    dlib::command_line_parser parser;
+    parser.add_option("dnn", "path to a model converted with convert_weights", 1);
+    parser.add_option("fused", "the model given to --dnn was converted with --fused");
+    parser.add_option("model", get_model_names() + " (default: yolov4x-mish)", 1);
+    parser.add_option("names", "path to file with label names (one per line)", 1);
+    parser.add_option("port", "port to listen on, on 127.0.0.1 (default: 8080)", 1);
+    parser.add_option("max-batch-size", "most images run in one forward pass (default: 8)", 1);
+    parser.add_option("max-delay", "ms a request waits for its batch to fill (default: 5)", 1);
+    parser.add_option("max-queue-size", "images queued before rejecting more (default: 64)", 1);
+    parser.add_option("max-body", "largest request body in MiB (default: 16)", 1);
+    parser.add_option("img-size", "image size to process, N or WxH (default: 416)", 1);
+    parser.add_option("letterbox", "keep the aspect ratio of the images and pad them");
+    parser.add_option("plan-memory", "reuse the memory of the layer outputs during inference");
+    parser.add_option("conf-thresh", "confidence threshold (default: 0.25)", 1);
+    parser.add_option("nms-thresh", "non-max suppression threshold (default: 0.45)", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+
+    if (not parser.option("dnn") or not parser.option("names"))
+    {
+        std::cout << "Specify the model and the label names with --dnn and --names\n";
+        return EXIT_FAILURE;
+    }
+
+    serve(parser);
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cout << e.what() << '\n';
+    return EXIT_FAILURE;
+}
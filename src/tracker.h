@@ -0,0 +1,255 @@
+#ifndef tracker_h_INCLUDED
+#define tracker_h_INCLUDED
+
+#include "yolo_utils.h"
+
+#include <algorithm>
+#include <dlib/filtering.h>
+#include <dlib/opencv.h>
+#include <dlib/optimization/max_cost_assignment.h>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+#include <vector>
+
+// Settings of detection_tracker.
+struct tracker_options
+{
+    // the detector runs at least every keyframe_interval frames
+    long keyframe_interval = 5;
+    // minimum IoU between a detection and the predicted box of a track to associate them
+    float iou_thresh = 0.3;
+    // keyframes a track survives without being matched to a detection
+    long max_misses = 2;
+    // measure the motion of each box between keyframes with sparse optical flow; when the
+    // flow of a box can't be measured the next frame becomes a keyframe
+    bool optical_flow = false;
+};
+
+// Carries the detections of keyframes forward to the frames in between, so the detector only
+// needs to run every few frames.  Each track has a constant velocity Kalman filter on the box
+// center, with the box size as a constant.  On keyframes, the detections are associated with
+// the predicted boxes of the tracks by maximizing their total IoU, and on the other frames
+// the tracks are either extrapolated or corrected with the median optical flow of the points
+// inside their box.  The boxes are normalized to the frame size, as the detections are.
+class detection_tracker
+{
+    public:
+    detection_tracker() = default;
+    explicit detection_tracker(const tracker_options& options) : options(options) {}
+
+    // true if the detector should run on the next frame
+    bool needs_detection() const
+    {
+        return frames_since_keyframe < 0 or
+               frames_since_keyframe + 1 >= options.keyframe_interval or flow_lost;
+    }
+
+    // Associates the detections of a keyframe with the tracks, starts a track for each
+    // unmatched detection and sets the track_id of all the detections.
+    void update(std::vector<detection>& detections, const dlib::matrix<dlib::rgb_pixel>& frame)
+    {
+        if (options.optical_flow)
+            set_gray(frame);
+        frames_since_keyframe = 0;
+        flow_lost = false;
+
+        // maximize the total IoU of the pairs, in an integer square matrix
+        const long size = std::max(tracks.size(), detections.size());
+        dlib::matrix<long> cost = dlib::zeros_matrix<long>(size, size);
+        for (size_t t = 0; t < tracks.size(); ++t)
+        {
+            const auto& track = tracks[t];
+            const detection predicted = track.get_box(track.filter.get_predicted_next_state());
+            for (size_t d = 0; d < detections.size(); ++d)
+            {
+                if (detections[d].id != predicted.id)
+                    continue;
+                const float overlap = iou(predicted, detections[d], IOU);
+                if (overlap >= options.iou_thresh)
+                    cost(t, d) = std::lround(overlap * 1000);
+            }
+        }
+        std::vector<long> assignment;
+        if (size > 0)
+            assignment = dlib::max_cost_assignment(cost);
+
+        std::vector<bool> matched(detections.size(), false);
+        for (size_t t = 0; t < tracks.size(); ++t)
+        {
+            auto& track = tracks[t];
+            const long d = assignment[t];
+            if (d < static_cast<long>(detections.size()) and cost(t, d) > 0)
+            {
+                matched[d] = true;
+                track.correct(detections[d]);
+                detections[d].track_id = track.id;
+                track.misses = 0;
+            }
+            else
+            {
+                track.filter.update();
+                ++track.misses;
+            }
+        }
+        tracks.erase(
+            std::remove_if(
+                tracks.begin(),
+                tracks.end(),
+                [this](const track_state& t) { return t.misses > options.max_misses; }),
+            tracks.end());
+        for (size_t d = 0; d < detections.size(); ++d)
+        {
+            if (matched[d])
+                continue;
+            tracks.emplace_back(next_id++, detections[d]);
+            detections[d].track_id = tracks.back().id;
+        }
+    }
+
+    // Moves the tracks to a frame without detections and returns their boxes.
+    void predict(std::vector<detection>& detections, const dlib::matrix<dlib::rgb_pixel>& frame)
+    {
+        ++frames_since_keyframe;
+        if (options.optical_flow)
+        {
+            previous_gray.swap(gray);
+            set_gray(frame);
+        }
+        detections.clear();
+        for (auto& track : tracks)
+        {
+            // only the tracks seen on the last keyframe are reported
+            if (track.misses > 0)
+            {
+                track.filter.update();
+                continue;
+            }
+            dlib::matrix<double, 2, 1> shift;
+            if (options.optical_flow and measure_flow(track, shift))
+            {
+                detection moved = track.last;
+                const auto& x = track.filter.get_current_state();
+                moved.x = x(0) + shift(0);
+                moved.y = x(1) + shift(1);
+                moved.w = x(2);
+                moved.h = x(3);
+                track.correct(moved);
+            }
+            else
+            {
+                flow_lost = flow_lost or options.optical_flow;
+                track.filter.update();
+            }
+            detections.push_back(track.get_box(track.filter.get_current_state()));
+        }
+    }
+
+    void clear()
+    {
+        tracks.clear();
+        frames_since_keyframe = -1;
+        flow_lost = false;
+    }
+
+    private:
+    struct track_state
+    {
+        track_state(const int id, const detection& d) : id(id), last(d)
+        {
+            // state: center x, center y, width, height, velocity x, velocity y
+            dlib::matrix<double, 6, 6> transition = dlib::identity_matrix<double>(6);
+            transition(0, 4) = 1;
+            transition(1, 5) = 1;
+            dlib::matrix<double, 4, 6> observation = dlib::zeros_matrix<double>(4, 6);
+            for (long i = 0; i < 4; ++i)
+                observation(i, i) = 1;
+            dlib::matrix<double, 6, 1> process_noise;
+            process_noise = 1e-5, 1e-5, 1e-5, 1e-5, 1e-4, 1e-4;
+            filter.set_transition_model(transition);
+            filter.set_observation_model(observation);
+            filter.set_process_noise(dlib::diagm(process_noise));
+            filter.set_measurement_noise(1e-4 * dlib::identity_matrix<double>(4));
+            filter.set_estimation_error_covariance(1e-2 * dlib::identity_matrix<double>(6));
+            correct(d);
+        }
+
+        void correct(const detection& d)
+        {
+            dlib::matrix<double, 4, 1> z;
+            z = d.x, d.y, d.w, d.h;
+            filter.update(z);
+            last = d;
+            last.track_id = id;
+        }
+
+        detection get_box(const dlib::matrix<double, 6, 1>& x) const
+        {
+            detection d = last;
+            d.x = x(0);
+            d.y = x(1);
+            d.w = std::max(0.0, x(2));
+            d.h = std::max(0.0, x(3));
+            return d;
+        }
+
+        int id;
+        detection last;  // class, scores and id of the last detection matched to the track
+        long misses = 0;
+        dlib::kalman_filter<6, 4> filter;
+    };
+
+    void set_gray(const dlib::matrix<dlib::rgb_pixel>& frame) { dlib::assign_image(gray, frame); }
+
+    // Measures the shift of the box of the track between the previous frame and the current
+    // one, as the median displacement of the corners found in the box, in normalized units.
+    bool measure_flow(const track_state& track, dlib::matrix<double, 2, 1>& shift)
+    {
+        if (previous_gray.size() == 0 or previous_gray.nr() != gray.nr() or
+            previous_gray.nc() != gray.nc())
+            return false;
+        const cv::Mat previous_mat = dlib::toMat(previous_gray);
+        const cv::Mat mat = dlib::toMat(gray);
+        const auto& x = track.filter.get_current_state();
+        const cv::Rect box = cv::Rect(0, 0, mat.cols, mat.rows) &
+                             cv::Rect(
+                                 std::lround((x(0) - x(2) / 2) * mat.cols),
+                                 std::lround((x(1) - x(3) / 2) * mat.rows),
+                                 std::lround(x(2) * mat.cols),
+                                 std::lround(x(3) * mat.rows));
+        if (box.width < 8 or box.height < 8)
+            return false;
+        mask = cv::Mat::zeros(mat.size(), CV_8UC1);
+        mask(box).setTo(255);
+        cv::goodFeaturesToTrack(previous_mat, points, 20, 0.01, 3, mask);
+        if (points.size() < 3)
+            return false;
+        cv::calcOpticalFlowPyrLK(previous_mat, mat, points, next_points, status, errors);
+        std::vector<float> dx, dy;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (not status[i])
+                continue;
+            dx.push_back(next_points[i].x - points[i].x);
+            dy.push_back(next_points[i].y - points[i].y);
+        }
+        if (dx.size() < 3)
+            return false;
+        std::nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+        shift = dx[dx.size() / 2] / mat.cols, dy[dy.size() / 2] / mat.rows;
+        return true;
+    }
+
+    tracker_options options;
+    std::vector<track_state> tracks;
+    int next_id = 0;
+    long frames_since_keyframe = -1;  // -1 before the first keyframe
+    bool flow_lost = false;
+    dlib::matrix<unsigned char> gray, previous_gray;
+    cv::Mat mask;
+    std::vector<cv::Point2f> points, next_points;
+    std::vector<unsigned char> status;
+    std::vector<float> errors;
+};
+
+#endif  // tracker_h_INCLUDED
@@ -1,8 +1,9 @@
 #ifndef ui_utils_h_INCLUDED
 #define ui_utils_h_INCLUDED
 
-#include "yolo.h"
+#include "yolo_utils.h"
 
+#include <atomic>
 #include <dlib/gui_widgets.h>
 #include <dlib/opencv.h>
 #include <opencv2/highgui.hpp>
@@ -23,20 +24,23 @@ inline auto get_random_color(const std::string& label) -> dlib::rgb_pixel
     return rgb;
 }
 
-inline auto get_color_map(const std::vector<std::string>& labels) -> std::map<std::string, dlib::rgb_pixel>
+// returns the color of each class, indexed by class id
+inline auto get_color_map(const std::vector<std::string>& labels) -> std::vector<dlib::rgb_pixel>
 {
-    std::map<std::string, dlib::rgb_pixel> label_to_color;
+    std::vector<dlib::rgb_pixel> colors;
+    colors.reserve(labels.size());
     for (const auto& label : labels)
     {
-        label_to_color[label] = get_random_color(label);
+        colors.push_back(get_random_color(label));
     }
-    return label_to_color;
+    return colors;
 }
 
 inline void render_bounding_boxes(
     dlib::matrix<dlib::rgb_pixel>& img,
     const std::vector<detection>& detections,
-    const std::map<std::string, dlib::rgb_pixel>& label_to_color,
+    const std::vector<std::string>& labels,
+    const std::vector<dlib::rgb_pixel>& colors,
     const bool draw_labels = true)
 {
     const double font_scale = 0.5;
@@ -53,9 +57,14 @@ inline void render_bounding_boxes(
             round(d.xstop() * img.nc()),
             round(d.ystop() * img.nr()));
         std::ostringstream sout;
-        sout << d.label << std::fixed << std::setprecision(0) << " (" << 100 * prob << "%)";
+        sout << get_label(d, labels);
+        if (d.track_id >= 0)
+            sout << " #" << d.track_id;
+        sout << std::fixed << std::setprecision(0) << " (" << 100 * prob << "%)";
         std::string label = sout.str();
-        const auto rgb = label_to_color.at(d.label);
+        const auto rgb = d.id >= 0 and static_cast<size_t>(d.id) < colors.size()
+                             ? colors[d.id]
+                             : dlib::rgb_pixel(128, 128, 128);
         int baseline = 0;
         auto ts = cv::getTextSize(label, font, font_scale, 2, &baseline);
         const auto bbox = cv::Rect(r.left(), r.top(), r.width(), r.height());
@@ -135,8 +144,9 @@ class webcam_window : public dlib::image_window
     {
         update_title();
     }
-    bool mirror = true;
-    float conf_thresh = 0.25;
+    // read by the capture and inference threads of the video pipeline
+    std::atomic<bool> mirror{true};
+    std::atomic<float> conf_thresh{0.25f};
 
     static void print_keyboard_shortcuts()
     {
@@ -153,7 +163,7 @@ class webcam_window : public dlib::image_window
     void update_title()
     {
         std::ostringstream sout;
-        sout << "YOLO @" << std::setprecision(2) << std::fixed << conf_thresh;
+        sout << "YOLO @" << std::setprecision(2) << std::fixed << conf_thresh.load();
         set_title(sout.str());
     }
     void on_keydown(unsigned long key, bool /*is_printable*/, unsigned long /*state*/) override
@@ -164,16 +174,16 @@ class webcam_window : public dlib::image_window
                 print_keyboard_shortcuts();
                 break;
             case 'm':
-                mirror = !mirror;
+                mirror = not mirror;
                 break;
             case '+':
             case 'k':
-                conf_thresh = std::min(conf_thresh + 0.05f, 1.0f);
+                conf_thresh = std::min(conf_thresh.load() + 0.05f, 1.0f);
                 update_title();
                 break;
             case '-':
             case 'j':
-                conf_thresh = std::max(conf_thresh - 0.05f, 0.05f);
+                conf_thresh = std::max(conf_thresh.load() - 0.05f, 0.05f);
                 update_title();
                 break;
             case 'q':
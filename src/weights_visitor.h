@@ -1,8 +1,12 @@
 #ifndef darknet_weights_visitor_h_INCLUDED
 #define darknet_weights_visitor_h_INCLUDED
 
+#include "layers.h"
+#include "mapped_file.h"
+
 #include <cstring>
 #include <dlib/dnn.h>
+#include <memory>
 
 namespace darknet
 {
@@ -10,7 +14,10 @@ namespace darknet
     class weights_visitor
     {
         public:
-        weights_visitor(const std::string& weights_path) : weights(read_bytes(weights_path))
+        // The visitor is copied by dlib::visit_layers_backwards(), so the mapped file and the
+        // read position are shared between the copies.
+        weights_visitor(const std::string& weights_path)
+            : state(std::make_shared<reader>(weights_path))
         {
             int32_t major = 0, minor = 0, revision = 0;
             int32_t batches_seen1;
@@ -30,14 +37,30 @@ namespace darknet
                 std::cout << batches_seen1;
             }
 
-            std::cout << ", num weights " << weights.size() << std::endl;
+            std::cout << ", num weights " << state->num_floats() << std::endl;
         }
 
-        ~weights_visitor()
+        // Throws if the network did not consume the whole weights file, which means it does not
+        // match the model the weights were trained for.
+        void check_end() const
         {
-            std::cout << "read " << offset << " floats of " << weights.size() << '\n';
+            std::cout << "read " << state->floats_read() << " floats of " << state->num_floats()
+                      << '\n';
+            if (state->remaining() != 0)
+                throw std::runtime_error(
+                    "weights file '" + state->path + "' has " +
+                    std::to_string(state->remaining()) +
+                    " bytes left after loading the network: it does not match the model");
         }
 
+        // The gammas of the batch normalizations read so far, in the order of the file, before
+        // they are folded with the variances.  They rank the channels for pruning.
+        const std::vector<matrix<float>>& get_bn_gammas() const { return state->bn_gammas; }
+
+        // The betas of the same batch normalizations, before they are folded with the means.  A
+        // channel with a zero gamma outputs its beta, which the pruning folds into the readers.
+        const std::vector<matrix<float>>& get_bn_betas() const { return state->bn_betas; }
+
         // ignore other layers
         template <typename T> void operator()(size_t, T&) {}
 
@@ -54,25 +77,12 @@ namespace darknet
 
             const auto num_b = bn_t.size() / 2;
 
-            // bn bias
-            matrix<float> temp_b(1, num_b);
-            for (size_t i = 0; i < num_b; ++i)
-                (*this) >> temp_b(i);
-
-            // bn weights
-            matrix<float> temp_g(1, num_b);
-            for (size_t i = 0; i < num_b; ++i)
-                (*this) >> temp_g(i);
-
-            // bn running mean
-            matrix<float> temp_m(1, num_b);
-            for (size_t i = 0; i < num_b; ++i)
-                (*this) >> temp_m(i);
-
-            // bn running var
-            matrix<float> temp_v(1, num_b);
-            for (size_t i = 0; i < num_b; ++i)
-                (*this) >> temp_v(i);
+            // bn bias, weights, running mean and running var
+            matrix<float> temp_b(1, num_b), temp_g(1, num_b), temp_m(1, num_b), temp_v(1, num_b);
+            for (auto* temp : {&temp_b, &temp_g, &temp_m, &temp_v})
+                read(&(*temp)(0), num_b);
+            state->bn_gammas.push_back(temp_g);
+            state->bn_betas.push_back(temp_b);
 
             g = pointwise_divide(temp_g, sqrt(temp_v + DEFAULT_BATCH_NORM_EPS));
             b = temp_b - pointwise_multiply(mat(g), temp_m);
@@ -81,9 +91,7 @@ namespace darknet
             auto& conv = l.subnet().layer_details();
             auto& conv_t = conv.get_layer_params();
             DLIB_CASSERT(conv.bias_is_disabled());
-            float* ptr = conv_t.host();
-            for (size_t i = 0; i < conv_t.size(); ++i)
-                (*this) >> ptr[i];
+            read(conv_t.host(), conv_t.size());
         }
 
         // convolutions
@@ -110,17 +118,54 @@ namespace darknet
                 DLIB_CASSERT(b.size() == biases.size());
 
                 // conv bias
-                float* ptr = b.host();
-                for (size_t i = 0; i < b.size(); ++i)
-                    (*this) >> ptr[i];
+                read(b.host(), b.size());
 
                 // conv filters
-                ptr = f.host();
-                for (size_t i = 0; i < f.size(); ++i)
-                    (*this) >> ptr[i];
+                read(f.host(), f.size());
             }
         }
 
+        // fused convolutions: the batch normalization is folded into the filters and biases
+        template <
+            long nf,
+            long nr,
+            long nc,
+            int sy,
+            int sx,
+            int py,
+            int px,
+            fused_activation act,
+            typename SUBNET>
+        void operator()(size_t, add_layer<fused_con_<nf, nr, nc, sy, sx, py, px, act>, SUBNET>& l)
+        {
+            auto& conv = l.layer_details();
+            const long num_f = conv.num_filters();
+
+            // bn bias, weights, running mean and running var
+            matrix<float> temp_b(1, num_f), temp_g(1, num_f), temp_m(1, num_f), temp_v(1, num_f);
+            for (auto* temp : {&temp_b, &temp_g, &temp_m, &temp_v})
+                read(&(*temp)(0), num_f);
+            state->bn_gammas.push_back(temp_g);
+            state->bn_betas.push_back(temp_b);
+            const matrix<float> scale =
+                pointwise_divide(temp_g, sqrt(temp_v + DEFAULT_BATCH_NORM_EPS));
+
+            // conv weight, scaled by the bn weights of its filter
+            auto f = conv.get_filters();
+            DLIB_CASSERT(f.num_samples() == num_f);
+            const size_t filter_size = f.size() / num_f;
+            float* ptr = f.host();
+            read(ptr, f.size());
+            for (long k = 0; k < num_f; ++k)
+            {
+                for (size_t i = 0; i < filter_size; ++i)
+                    *ptr++ *= scale(k);
+            }
+
+            auto b = conv.get_biases();
+            b = temp_b - pointwise_multiply(scale, temp_m);
+        }
+
         // fully connected layers
         template <unsigned long num_outputs, fc_bias_mode bias_mode, typename SUBNET>
         void operator()(size_t, add_layer<fc_<num_outputs, bias_mode>, SUBNET>& l)
@@ -141,9 +186,7 @@ namespace darknet
                 auto biases = biases_alias(params, filters.size());
 
                 // bias
-                float* ptr = biases.host();
-                for (size_t i = 0; i < biases.size(); i++)
-                    (*this) >> ptr[i];
+                read(biases.host(), biases.size());
             }
 
             // weights - For some reason dlib's fc layer does not use the normal convention for
@@ -151,13 +194,7 @@ namespace darknet
             // [num_outputs,num_inputs], but dlib uses [num_inputs,num_outputs] So me must
             // transpose from darknet
             matrix<float> temp_f(num_outputs, num_inputs);
-            for (long r = 0; r < temp_f.nr(); r++)  // num_outputs
-            {
-                for (long c = 0; c < temp_f.nc(); c++)  // num_inputs
-                {
-                    (*this) >> temp_f(r, c);
-                }
-            }
+            read(&temp_f(0, 0), temp_f.size());
 
             // You don't need to do the following, instead you could modify the order of the
             // for-loops that follow. But this makes our intentions explicit.
@@ -174,33 +211,38 @@ namespace darknet
         }
 
         private:
-        const std::vector<char> weights;
-        size_t offset = 0;
-
-        std::vector<char> read_bytes(const std::string& filename)
+        struct reader
         {
-            std::ifstream file(filename, std::ios::binary);
-            file.seekg(0, std::ios::end);
-            const size_t filesize = file.tellg();
-            file.seekg(0);
-            
-            std::vector<char> v;
-            v.reserve(filesize); //allocate the exact space required ONCE.
-            
-            std::copy(
-                std::istreambuf_iterator<char>(file),
-                std::istreambuf_iterator<char>(),
-                std::back_inserter(v));
-            return v;
+            explicit reader(const std::string& path) : path(path), file(path) {}
+            size_t remaining() const { return file.size() - offset; }
+            size_t num_floats() const { return file.size() / sizeof(float); }
+            size_t floats_read() const { return offset / sizeof(float); }
+            const std::string path;
+            const mapped_file file;
+            size_t offset = 0;
+            std::vector<matrix<float>> bn_gammas;
+            std::vector<matrix<float>> bn_betas;
+        };
+        std::shared_ptr<reader> state;
+
+        // copies the next num_bytes of the weights file into dst
+        void read_bytes(void* dst, const size_t num_bytes)
+        {
+            if (num_bytes > state->remaining())
+                throw std::runtime_error(
+                    "weights file '" + state->path + "' is truncated: " +
+                    std::to_string(num_bytes) + " bytes needed at offset " +
+                    std::to_string(state->offset) + " but the file has " +
+                    std::to_string(state->file.size()) + " bytes");
+            std::memcpy(dst, state->file.data() + state->offset, num_bytes);
+            state->offset += num_bytes;
         }
 
+        void read(float* dst, const size_t count) { read_bytes(dst, count * sizeof(float)); }
+
         template <typename T> weights_visitor& operator>>(T& x)
         {
-            //Don't use type punning. 
-            //Apparently, that's bad and can cause undefined behaviour. 
-            //Instead, use memcpy()
-            std::memcpy(&x, &weights[offset], sizeof(T));
-            offset += sizeof(T);
+            read_bytes(&x, sizeof(T));
             return *this;
         }
     };
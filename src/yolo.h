@@ -1,10 +1,14 @@
 #ifndef yolo_h_INCLUDED
 #define yolo_h_INCLUDED
 
+#include "activation_planner.h"
 #include "darknet.h"
+#include "detector.h"
+#include "mapped_model.h"
+#include "profiler.h"
 #include "yolo_utils.h"
 
-template <typename net_type> class yolo_detector
+template <typename net_type> class yolo_detector : public object_detector
 {
     public:
     yolo_detector() = default;
@@ -17,29 +21,203 @@ template <typename net_type> class yolo_detector
     void detect(
         const dlib::image_view<dlib::matrix<dlib::rgb_pixel>> image,
         std::vector<detection>& detections,
-        const long image_size = 512,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45) override
+    {
+        inputs.resize(std::max<size_t>(inputs.size(), 1));
+        transforms.resize(inputs.size());
+        const auto t0 = clock::now();
+        preprocess(image, image_size, 0);
+        const auto t1 = clock::now();
+        run_network(inputs.begin(), inputs.begin() + 1);
+        stage_times.preprocess += t1 - t0;
+        stage_times.forward += clock::now() - t1;
+        decode(0, conf_thresh, nms_thresh, detections);
+    }
+
+    // Runs all the images in [ibegin, iend) through the network as a single batch and
+    // stores the detections of the i-th image in detections[i].
+    template <typename image_iterator>
+    void detect_batch(
+        image_iterator ibegin,
+        image_iterator iend,
+        std::vector<std::vector<detection>>& detections,
+        const input_size image_size = 512,
         const float conf_thresh = 0.25,
         const float nms_thresh = 0.45)
     {
-        dlib::matrix<dlib::rgb_pixel> scaled(image_size, image_size);
-        dlib::resize_image(image, scaled);
-        net(scaled);
-        const auto& out8 = dlib::layer<darknet::ytag8>(net).get_output();
-        const auto& out16 = dlib::layer<darknet::ytag16>(net).get_output();
-        const auto& out32 = dlib::layer<darknet::ytag32>(net).get_output();
-        add_detections(out8, anchors8, labels, 8, conf_thresh, detections, new_coords);
-        add_detections(out16, anchors16, labels, 16, conf_thresh, detections, new_coords);
-        add_detections(out32, anchors32, labels, 32, conf_thresh, detections, new_coords);
-        nms(conf_thresh, nms_thresh, detections);
+        const long num_images = std::distance(ibegin, iend);
+        detections.resize(num_images);
+        if (num_images == 0)
+            return;
+        inputs.resize(std::max<size_t>(inputs.size(), num_images));
+        transforms.resize(inputs.size());
+        const auto t0 = clock::now();
+        long n = 0;
+        for (auto i = ibegin; i != iend; ++i, ++n)
+            preprocess(*i, image_size, n);
+        const auto t1 = clock::now();
+        run_network(inputs.begin(), inputs.begin() + num_images);
+        stage_times.preprocess += t1 - t0;
+        stage_times.forward += clock::now() - t1;
+        for (n = 0; n < num_images; ++n)
+        {
+            detections[n].clear();
+            decode(n, conf_thresh, nms_thresh, detections[n]);
+        }
     }
 
-    std::vector<std::string> get_labels() { return labels; };
+    void detect_batch(
+        const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+        std::vector<std::vector<detection>>& detections,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45) override
+    {
+        detect_batch(images.begin(), images.end(), detections, image_size, conf_thresh, nms_thresh);
+    }
+
+    // Splits a large image into overlapping tiles, runs them through the network in batches
+    // and merges the detections, which are in the coordinates of the whole image, with a last
+    // non-max suppression that removes the duplicates found at the seams.
+    void detect_tiled(
+        const dlib::matrix<dlib::rgb_pixel>& image,
+        std::vector<detection>& detections,
+        const input_size image_size = 512,
+        const float conf_thresh = 0.25,
+        const float nms_thresh = 0.45,
+        const tiling_options& options = tiling_options()) override
+    {
+        DLIB_CASSERT(options.overlap >= 0 and options.overlap < 1);
+        DLIB_CASSERT(options.batch_size > 0);
+        long tile_nc = image_size.width;
+        long tile_nr = image_size.height;
+        if (options.tile_size > 0)
+        {
+            tile_nc = options.tile_size;
+            tile_nr = std::lround(static_cast<double>(tile_nc) * tile_nr / image_size.width);
+        }
+        const auto tiles = get_tiles(image.nr(), image.nc(), tile_nr, tile_nc, options);
+        const long batch_size = options.batch_size;
+        inputs.resize(std::max<size_t>(inputs.size(), batch_size));
+        transforms.resize(inputs.size());
+        detections.clear();
+        std::vector<detection> tile_detections;
+        for (size_t begin = 0; begin < tiles.size(); begin += batch_size)
+        {
+            const long num_tiles = std::min<long>(batch_size, tiles.size() - begin);
+            const auto t0 = clock::now();
+            dlib::parallel_for(
+                0,
+                num_tiles,
+                [&](const long n)
+                {
+                    const auto& tile = tiles[begin + n];
+                    preprocess(dlib::sub_image(image, tile), image_size, n);
+                    // map the boxes of the tile to the whole image
+                    auto& tform = transforms[n];
+                    tform.x_offset -= tile.left() / (tile.width() * tform.x_scale);
+                    tform.y_offset -= tile.top() / (tile.height() * tform.y_scale);
+                    tform.x_scale *= static_cast<float>(tile.width()) / image.nc();
+                    tform.y_scale *= static_cast<float>(tile.height()) / image.nr();
+                });
+            const auto t1 = clock::now();
+            run_network(inputs.begin(), inputs.begin() + num_tiles);
+            stage_times.preprocess += t1 - t0;
+            stage_times.forward += clock::now() - t1;
+            for (long n = 0; n < num_tiles; ++n)
+            {
+                tile_detections.clear();
+                decode(n, conf_thresh, nms_thresh, tile_detections);
+                detections.insert(
+                    detections.end(),
+                    tile_detections.begin(),
+                    tile_detections.end());
+            }
+        }
+        const auto t0 = clock::now();
+        nms(conf_thresh, nms_thresh, detections, nms_opts);
+        stage_times.nms += clock::now() - t0;
+    }
+
+    const std::vector<std::string>& get_labels() const override { return labels; };
+
+    // When enabled, images are resized preserving their aspect ratio and padded to the
+    // network input size, instead of being stretched.
+    void set_letterbox(const bool enable) override { letterbox = enable; }
+    bool get_letterbox() const override { return letterbox; }
+
+    void set_nms_options(const nms_options& options) override { nms_opts = options; }
+    const nms_options& get_nms_options() const override { return nms_opts; }
+
+    // When enabled, the network runs one layer at a time and the memory of the layer outputs
+    // is reused once they are no longer needed, see darknet::activation_planner.
+    void set_memory_planning(const bool enable) override
+    {
+        memory_planning = enable;
+        if (not enable)
+            planner.reset();
+    }
+    bool get_memory_planning() const override { return memory_planning; }
+
+    // the planner of the last forward pass, or nullptr without memory planning
+    const darknet::activation_planner<net_type>* get_activation_planner() const override
+    {
+        return planner.get();
+    }
+
+    const detection_stage_times& get_stage_times() const override { return stage_times; }
+    void reset_stage_times() override { stage_times = detection_stage_times(); }
+
+    // gives access to the network, e.g. to prune its channels
+    net_type& get_net() { return net; }
+    const net_type& get_net() const { return net; }
 
-    void print() const { std::cout << net << std::endl; };
+    void print() const override { std::cout << net << std::endl; };
+
+    void save(const std::string& path) const override { dlib::serialize(path) << net; }
+    void save_mapped(const std::string& path) const override { darknet::save_mapped(net, path); }
+
+    void set_calibrating(const bool value) override { darknet::set_calibrating(net, value); }
+    size_t quantize_int8() override { return darknet::quantize_int8(net); }
+
+    void profile(
+        const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+        const input_size image_size,
+        const long iterations,
+        std::ostream& out,
+        const std::string& trace_path = "") override
+    {
+        darknet::layer_profiler profiler(net);
+        dlib::matrix<dlib::rgb_pixel> scaled(image_size.height, image_size.width);
+        for (long i = 0; i < iterations; ++i)
+        {
+            dlib::resize_image(images[i % images.size()], scaled);
+            profiler.profile(scaled);
+        }
+        profiler.print_summary(out);
+        if (not trace_path.empty())
+            profiler.save_chrome_trace(trace_path);
+    }
+
+    std::unique_ptr<object_detector> clone() const override
+    {
+        return std::make_unique<yolo_detector>(*this);
+    }
 
     protected:
+    using clock = std::chrono::steady_clock;
+    // the tiny models only have the outputs of strides 16 and 32
+    static constexpr bool has_stride8 = darknet::has_tag<net_type, darknet::ytag8>::value;
     bool new_coords = false;
-    void load_weights(const std::string& dnn_path) { dlib::deserialize(dnn_path) >> net; };
+    void load_weights(const std::string& dnn_path)
+    {
+        if (darknet::is_mapped_model(dnn_path))
+            darknet::load_mapped(net, dnn_path);
+        else
+            dlib::deserialize(dnn_path) >> net;
+    };
 
     void load_labels(const std::string& labels_path)
     {
@@ -49,9 +227,130 @@ template <typename net_type> class yolo_detector
         for (std::string line; std::getline(fin, line);)
             labels.push_back(line);
     }
+
+    // Tiles of tile_nr by tile_nc pixels covering an image, the last tile of each row and column
+    // is aligned to the border of the image, and the whole image comes first with
+    // options.full_frame.
+    static std::vector<dlib::rectangle> get_tiles(
+        const long nr,
+        const long nc,
+        const long tile_nr,
+        const long tile_nc,
+        const tiling_options& options)
+    {
+        const auto get_starts = [&](const long size, const long tile_size)
+        {
+            std::vector<long> starts{0};
+            const long stride = std::max(1l, std::lround(tile_size * (1 - options.overlap)));
+            while (starts.back() + tile_size < size)
+                starts.push_back(std::min(starts.back() + stride, size - tile_size));
+            return starts;
+        };
+        std::vector<dlib::rectangle> tiles;
+        if (options.full_frame)
+            tiles.push_back(dlib::rectangle(0, 0, nc - 1, nr - 1));
+        for (const long top : get_starts(nr, tile_nr))
+        {
+            for (const long left : get_starts(nc, tile_nc))
+            {
+                tiles.push_back(dlib::rectangle(
+                    left,
+                    top,
+                    std::min(left + tile_nc, nc) - 1,
+                    std::min(top + tile_nr, nr) - 1));
+            }
+        }
+        return tiles;
+    }
+
+    template <typename iterator> void run_network(iterator ibegin, iterator iend)
+    {
+        if (not memory_planning)
+        {
+            net(ibegin, iend);
+            return;
+        }
+        // a copied detector gets its own planner on its first pass
+        if (not planner or &planner->get_net() != &net)
+        {
+            std::vector<const dlib::tensor*> outputs{
+                &dlib::layer<darknet::ytag16>(net).get_output(),
+                &dlib::layer<darknet::ytag32>(net).get_output()};
+            if constexpr (has_stride8)
+                outputs.push_back(&dlib::layer<darknet::ytag8>(net).get_output());
+            planner = std::make_shared<darknet::activation_planner<net_type>>(net, outputs);
+        }
+        net.to_tensor(ibegin, iend, input_tensor);
+        planner->forward(input_tensor);
+    }
+
+    // Scales the image into the n-th input buffer and records how to map the boxes back.
+    // The buffers are kept across calls, so this does not allocate once they are sized.
+    template <typename image_type>
+    void preprocess(const image_type& image, const input_size image_size, const long n)
+    {
+        auto& input = inputs[n];
+        auto& tform = transforms[n];
+        input.set_size(image_size.height, image_size.width);
+        if (not letterbox)
+        {
+            dlib::resize_image(image, input);
+            tform = box_transform();
+            return;
+        }
+        const double scale = std::min(
+            static_cast<double>(input.nc()) / dlib::num_columns(image),
+            static_cast<double>(input.nr()) / dlib::num_rows(image));
+        const long nc = std::max(1l, std::lround(dlib::num_columns(image) * scale));
+        const long nr = std::max(1l, std::lround(dlib::num_rows(image) * scale));
+        const long left = (input.nc() - nc) / 2;
+        const long top = (input.nr() - nr) / 2;
+        dlib::assign_all_pixels(input, dlib::rgb_pixel(127, 127, 127));
+        auto roi = dlib::sub_image(input, dlib::rectangle(left, top, left + nc - 1, top + nr - 1));
+        dlib::resize_image(image, roi);
+        tform.x_offset = static_cast<float>(left) / input.nc();
+        tform.y_offset = static_cast<float>(top) / input.nr();
+        tform.x_scale = static_cast<float>(input.nc()) / nc;
+        tform.y_scale = static_cast<float>(input.nr()) / nr;
+    }
+
+    // decodes the yolo outputs of the given sample of the last forward pass
+    void decode(
+        const long sample,
+        const float conf_thresh,
+        const float nms_thresh,
+        std::vector<detection>& detections)
+    {
+        const auto& out16 = dlib::layer<darknet::ytag16>(net).get_output();
+        const auto& out32 = dlib::layer<darknet::ytag32>(net).get_output();
+        const auto& tform = transforms[sample];
+        const auto t0 = clock::now();
+        // clang-format off
+        if constexpr (has_stride8)
+        {
+            const auto& out8 = dlib::layer<darknet::ytag8>(net).get_output();
+            add_detections(out8, sample, anchors8, 8, conf_thresh, detections, new_coords, tform);
+        }
+        add_detections(out16, sample, anchors16, 16, conf_thresh, detections, new_coords, tform);
+        add_detections(out32, sample, anchors32, 32, conf_thresh, detections, new_coords, tform);
+        // clang-format on
+        const auto t1 = clock::now();
+        nms(conf_thresh, nms_thresh, detections, nms_opts);
+        stage_times.decode += t1 - t0;
+        stage_times.nms += clock::now() - t1;
+    }
+
     net_type net;
     std::vector<std::string> labels;
     std::vector<std::pair<float, float>> anchors8, anchors16, anchors32;
+    bool letterbox = false;
+    nms_options nms_opts;
+    std::vector<dlib::matrix<dlib::rgb_pixel>> inputs;
+    std::vector<box_transform> transforms;
+    detection_stage_times stage_times;
+    bool memory_planning = false;
+    std::shared_ptr<darknet::activation_planner<net_type>> planner;
+    dlib::resizable_tensor input_tensor;
 };
 
 #endif  // yolo_h_INCLUDED
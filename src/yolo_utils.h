@@ -2,7 +2,14 @@
 #define yolo_utils_h_INCLUDED
 
 #include <dlib/dnn.h>
+#include <numeric>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
+// A fixed-size detection record.  Only the class id is stored: the label is looked up in the
+// detector's label table when the detection is printed or rendered.
 struct detection
 {
     float x = 0;
@@ -12,7 +19,7 @@ struct detection
     float obj = 0;
     float score = 0;
     int id = -1;
-    std::string label = "";
+    int track_id = -1;  // set by detection_tracker
 
     float xstart() const { return x - 0.5 * w; }
     float xstop() const { return x + 0.5 * w; }
@@ -25,24 +32,43 @@ struct detection
     }
     void set_empty()
     {
-        detection empty;
-        std::swap(*this, empty);
+        *this = detection();
     }
     bool operator==(const detection& o) const
     {
-        return std::tie(x, y, w, h, obj, score, id, label) ==
-               std::tie(o.x, o.y, o.w, o.h, o.obj, o.score, o.id, o.label);
+        return std::tie(x, y, w, h, obj, score, id) ==
+               std::tie(o.x, o.y, o.w, o.h, o.obj, o.score, o.id);
     }
     friend std::ostream& operator<<(std::ostream& os, const detection& d);
 };
 
+static_assert(std::is_trivially_copyable<detection>::value, "detection must stay a plain record");
+
 inline std::ostream& operator<<(std::ostream& os, const detection& d)
 {
-    os << d.id << " " << d.label << " " << d.score << " : x " << d.x << " y " << d.y << " w "
-       << d.w << " h " << d.h;
+    os << d.id << " " << d.score << " : x " << d.x << " y " << d.y << " w " << d.w << " h "
+       << d.h;
     return os;
 }
 
+inline const std::string& get_label(const detection& d, const std::vector<std::string>& labels)
+{
+    static const std::string unknown = "unknown";
+    if (d.id < 0 or static_cast<size_t>(d.id) >= labels.size())
+        return unknown;
+    return labels[d.id];
+}
+
+// Maps box coordinates, normalized to the network input, back to the source image:
+// x_src = (x - x_offset) * x_scale and w_src = w * x_scale (same for y and h).
+struct box_transform
+{
+    float x_offset = 0;
+    float y_offset = 0;
+    float x_scale = 1;
+    float y_scale = 1;
+};
+
 typedef enum
 {
     IOU = 0,
@@ -102,124 +128,294 @@ constexpr inline float sigmoid(const float x)
     return 1.0f / (1.0f + std::exp(-x));
 }
 
-inline void add_detections(
+// Appends to indices the position of every element of data[0, size) greater than thresh.
+inline void find_above(
+    const float* const data,
+    const long size,
+    const float thresh,
+    std::vector<long>& indices)
+{
+    long i = 0;
+#if defined(__AVX__)
+    const __m256 th = _mm256_set1_ps(thresh);
+    for (; i + 8 <= size; i += 8)
+    {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(data + i), th, _CMP_GT_OQ));
+        for (; mask != 0; mask &= mask - 1)
+            indices.push_back(i + __builtin_ctz(mask));
+    }
+#elif defined(__SSE2__)
+    const __m128 th = _mm_set1_ps(thresh);
+    for (; i + 4 <= size; i += 4)
+    {
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(data + i), th));
+        for (; mask != 0; mask &= mask - 1)
+            indices.push_back(i + __builtin_ctz(mask));
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        if (data[i] > thresh)
+            indices.push_back(i);
+    }
+}
+
+// Decodes one sample of a yolo output tensor.  The objectness plane of each anchor is scanned
+// contiguously and only the cells above the threshold are decoded.  The class with the
+// highest raw output is selected first, so the sigmoid is evaluated once per candidate.
+// When new_coords is false, the outputs are logits and the objectness threshold is compared
+// against the logit of conf_thresh.  A nclasses of 0 means the number of classes is read from
+// the tensor.
+template <bool new_coords, long nclasses = 0>
+void decode_yolo_output(
     const dlib::tensor& t,
+    const long sample,
     const std::vector<std::pair<float, float>>& anchors,
-    const std::vector<std::string>& labels,
     const int stride,
     const float conf_thresh,
     std::vector<detection>& detections,
-    bool new_coords = false)
+    const box_transform& tform)
 {
-    const size_t nattr = t.k() / anchors.size();
-    const size_t nclasses = nattr - 5;
-    const float* const out = t.host();
+    const long nattr = t.k() / anchors.size();
+    const long num_classes = nclasses > 0 ? nclasses : nattr - 5;
+    DLIB_ASSERT(num_classes == nattr - 5);
+    const long plane_size = t.nr() * t.nc();
+    const float* const out = t.host() + sample * t.k() * plane_size;
+    float obj_thresh = conf_thresh;
+    if (not new_coords)
+    {
+        if (conf_thresh <= 0)
+            obj_thresh = -std::numeric_limits<float>::infinity();
+        else if (conf_thresh >= 1)
+            obj_thresh = std::numeric_limits<float>::infinity();
+        else
+            obj_thresh = std::log(conf_thresh / (1 - conf_thresh));
+    }
+
+    thread_local std::vector<long> cells;
     for (size_t a = 0; a < anchors.size(); ++a)
     {
+        const float* const xs = out + (a * nattr + 0) * plane_size;
+        const float* const ys = out + (a * nattr + 1) * plane_size;
+        const float* const ws = out + (a * nattr + 2) * plane_size;
+        const float* const hs = out + (a * nattr + 3) * plane_size;
+        const float* const os = out + (a * nattr + 4) * plane_size;
+        const float* const cs = out + (a * nattr + 5) * plane_size;
+        const float anchor_w = anchors[a].first / (t.nc() * stride);
+        const float anchor_h = anchors[a].second / (t.nr() * stride);
 
-        /*
-        // clang-format off
-        const dlib::matrix<float> xs = dlib::image_plane(t, 0, a * nattr + 0);
-        const dlib::matrix<float> ys = dlib::image_plane(t, 0, a * nattr + 1);
-        const dlib::matrix<float> ws = dlib::squared(dlib::image_plane(t, 0, a * nattr + 2)) * 4 *
-        anchors[a].first / (t.nc() * stride); const dlib::matrix<float> hs =
-        dlib::squared(dlib::image_plane(t, 0, a * nattr + 3)) * 4 * anchors[a].second / (t.nr() *
-        stride); const dlib::matrix<float> os = dlib::image_plane(t, 0, a * nattr + 4); const
-        dlib::matrix<float> cs = dlib::image_plane(t, 0, a * nattr + 5);
-        // clang-format on
-
-        for (long r = 0; r < t.nr(); ++r)
+        cells.clear();
+        find_above(os, plane_size, obj_thresh, cells);
+        for (const long i : cells)
         {
-            for (long c = 0; c < t.nc(); ++c)
+            const long y = i / t.nc();
+            const long x = i - y * t.nc();
+            const float* const c = cs + i;
+            long id = 0;
+            float best = c[0];
+            for (long p = 1; p < num_classes; ++p)
             {
-                if (os(r, c) > conf_thresh)
+                const float temp = c[p * plane_size];
+                if (temp > best)
                 {
-                    detection d;
-                    d.obj = os(r, c);
-                    d.x = (xs(r, c) + c) / t.nc();
-                    d.y = (ys(r, c) + r) / t.nr();
-                    d.w = ws(r, c);
-                    d.h = hs(r, c);
-                    for (size_t p = 0; p < nclasses; ++p)
-                    {
-                        if (cs(r, c) > d.score)
-                        {
-                            d.score = cs(r, c);
-                            d.id = p;
-                            d.label = labels[d.id];
-                        }
-                    }
-                    d.score *= d.obj;
-                    detections.push_back(std::move(d));
+                    best = temp;
+                    id = p;
                 }
             }
-        }
-        */
 
-        for (long y = 0; y < t.nr(); ++y)
-        {
-            for (long x = 0; x < t.nc(); ++x)
+            detection d;
+            if constexpr (new_coords)
             {
-                if (new_coords)
-                {
-                    const float obj = out[dlib::tensor_index(t, 0, a * nattr + 4, y, x)];
-                    // clang-format off
-                    if (obj > conf_thresh)
-                    {
-                        detection d;
-                        d.obj = obj;
-                        d.x = (out[dlib::tensor_index(t, 0, a * nattr + 0, y, x)] + x) / t.nc();
-                        d.y = (out[dlib::tensor_index(t, 0, a * nattr + 1, y, x)] + y) / t.nr();
-                        d.w = out[dlib::tensor_index(t, 0, a * nattr + 2, y, x)] *
-                              out[dlib::tensor_index(t, 0, a * nattr + 2, y, x)] * 4 * anchors[a].first / (t.nc() * stride);
-                        d.h = out[dlib::tensor_index(t, 0, a * nattr + 3, y, x)] *
-                              out[dlib::tensor_index(t, 0, a * nattr + 3, y, x)] * 4 * anchors[a].second / (t.nr() * stride);
-                        for (size_t p = 0; p < nclasses; ++p)
-                        {
-                            const float temp = out[dlib::tensor_index(t, 0, a * nattr + 5 + p, y, x)];
-                            if (temp > d.score)
-                            {
-                                d.score = temp;
-                                d.id = p;
-                                d.label = labels[d.id];
-                            }
-                        }
-                        d.score *= d.obj;
-                        detections.push_back(std::move(d));
-                    }
-                }
-                else
-                {
-                    const float obj = sigmoid(out[dlib::tensor_index(t, 0, a * nattr + 4, y, x)]);
-                    if (obj > conf_thresh)
-                    {
-                        detection d;
-                        d.obj = obj;
-                        d.x = (sigmoid(out[dlib::tensor_index(t, 0, a * nattr + 0, y, x)]) + x) / t.nc();
-                        d.y = (sigmoid(out[dlib::tensor_index(t, 0, a * nattr + 1, y, x)]) + y) / t.nr();
-                        d.w = std::exp(out[dlib::tensor_index(t, 0, a * nattr + 2, y, x)]) * anchors[a].first / (t.nc() * stride);
-                        d.h = std::exp(out[dlib::tensor_index(t, 0, a * nattr + 3, y, x)]) * anchors[a].second / (t.nr() * stride);
-                        for (size_t p = 0; p < nclasses; ++p)
-                        {
-                            const float temp = sigmoid(out[dlib::tensor_index(t, 0, a * nattr + 5 + p, y, x)]);
-                            if (temp > d.score)
-                            {
-                                d.score = temp;
-                                d.id = p;
-                                d.label = labels[d.id];
-                            }
-                        }
-                        d.score *= d.obj;
-                        detections.push_back(std::move(d));
-                    }
-                }
-                // clang-format on
+                d.obj = os[i];
+                d.score = best;
+                d.x = (xs[i] + x) / t.nc();
+                d.y = (ys[i] + y) / t.nr();
+                d.w = ws[i] * ws[i] * 4 * anchor_w;
+                d.h = hs[i] * hs[i] * 4 * anchor_h;
+            }
+            else
+            {
+                d.obj = sigmoid(os[i]);
+                d.score = sigmoid(best);
+                d.x = (sigmoid(xs[i]) + x) / t.nc();
+                d.y = (sigmoid(ys[i]) + y) / t.nr();
+                d.w = std::exp(ws[i]) * anchor_w;
+                d.h = std::exp(hs[i]) * anchor_h;
+            }
+            // a class is only assigned when its output is positive
+            if (d.score > 0)
+            {
+                d.id = id;
             }
+            else
+            {
+                d.score = 0;
+            }
+            d.score *= d.obj;
+            d.x = (d.x - tform.x_offset) * tform.x_scale;
+            d.y = (d.y - tform.y_offset) * tform.y_scale;
+            d.w *= tform.x_scale;
+            d.h *= tform.y_scale;
+            detections.push_back(std::move(d));
+        }
+    }
+}
+
+inline void add_detections(
+    const dlib::tensor& t,
+    const long sample,
+    const std::vector<std::pair<float, float>>& anchors,
+    const int stride,
+    const float conf_thresh,
+    std::vector<detection>& detections,
+    bool new_coords = false,
+    const box_transform& tform = box_transform())
+{
+    const long nclasses = t.k() / anchors.size() - 5;
+    // clang-format off
+    if (new_coords)
+    {
+        if (nclasses == 80)
+            decode_yolo_output<true, 80>(t, sample, anchors, stride, conf_thresh, detections, tform);
+        else
+            decode_yolo_output<true>(t, sample, anchors, stride, conf_thresh, detections, tform);
+    }
+    else
+    {
+        if (nclasses == 80)
+            decode_yolo_output<false, 80>(t, sample, anchors, stride, conf_thresh, detections, tform);
+        else
+            decode_yolo_output<false>(t, sample, anchors, stride, conf_thresh, detections, tform);
+    }
+    // clang-format on
+}
+
+struct nms_options
+{
+    // IOU and DIOU are vectorized, GIOU and CIOU fall back to iou()
+    iout_t iou_type = IOU;
+    // maximum number of candidates per class kept before suppression (0 keeps all of them)
+    size_t top_k = 0;
+    // suppress overlapping boxes regardless of their class
+    bool class_agnostic = false;
+};
+
+// Structure-of-arrays copy of the candidates of one class, padded to a multiple of 8 boxes
+// with empty boxes that never overlap anything.
+struct nms_boxes
+{
+    std::vector<float> x1, y1, x2, y2, area;
+
+    void assign(const std::vector<detection>& detections, const uint32_t* idx, const size_t n)
+    {
+        const size_t padded = (n + 7) & ~size_t(7);
+        for (auto* v : {&x1, &y1, &x2, &y2, &area})
+            v->assign(padded, 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const auto& d = detections[idx[i]];
+            x1[i] = d.xstart();
+            y1[i] = d.ystart();
+            x2[i] = d.xstop();
+            y2[i] = d.ystop();
+            area[i] = d.w * d.h;
         }
     }
+
+    size_t size() const { return x1.size(); }
+};
+
+// Sets the bit j of suppressed for every box j > i of boxes that overlaps box i by more than
+// thresh.  Bit j lives in suppressed[j / 64].
+inline void suppress_overlaps(
+    const nms_boxes& boxes,
+    const size_t i,
+    const float thresh,
+    const iout_t type,
+    uint64_t* const suppressed)
+{
+    const bool diou = type == DIOU;
+    size_t j = (i + 1) & ~size_t(7);
+#if defined(__AVX__)
+    const __m256 ax1 = _mm256_set1_ps(boxes.x1[i]);
+    const __m256 ay1 = _mm256_set1_ps(boxes.y1[i]);
+    const __m256 ax2 = _mm256_set1_ps(boxes.x2[i]);
+    const __m256 ay2 = _mm256_set1_ps(boxes.y2[i]);
+    const __m256 aarea = _mm256_set1_ps(boxes.area[i]);
+    const __m256 th = _mm256_set1_ps(thresh);
+    const __m256 zero = _mm256_setzero_ps();
+    for (; j < boxes.size(); j += 8)
+    {
+        const __m256 bx1 = _mm256_loadu_ps(&boxes.x1[j]);
+        const __m256 by1 = _mm256_loadu_ps(&boxes.y1[j]);
+        const __m256 bx2 = _mm256_loadu_ps(&boxes.x2[j]);
+        const __m256 by2 = _mm256_loadu_ps(&boxes.y2[j]);
+        const __m256 iw = _mm256_max_ps(
+            zero,
+            _mm256_sub_ps(_mm256_min_ps(ax2, bx2), _mm256_max_ps(ax1, bx1)));
+        const __m256 ih = _mm256_max_ps(
+            zero,
+            _mm256_sub_ps(_mm256_min_ps(ay2, by2), _mm256_max_ps(ay1, by1)));
+        const __m256 inter = _mm256_mul_ps(iw, ih);
+        const __m256 uni = _mm256_sub_ps(
+            _mm256_add_ps(aarea, _mm256_loadu_ps(&boxes.area[j])),
+            inter);
+        __m256 iou = _mm256_div_ps(inter, uni);
+        if (diou)
+        {
+            const __m256 cw = _mm256_sub_ps(_mm256_max_ps(ax2, bx2), _mm256_min_ps(ax1, bx1));
+            const __m256 ch = _mm256_sub_ps(_mm256_max_ps(ay2, by2), _mm256_min_ps(ay1, by1));
+            const __m256 c2 = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(cw, cw), _mm256_mul_ps(ch, ch)),
+                _mm256_set1_ps(1e-16));
+            // the distance between the centers, times 2 on each axis
+            const __m256 dx = _mm256_sub_ps(_mm256_add_ps(bx1, bx2), _mm256_add_ps(ax1, ax2));
+            const __m256 dy = _mm256_sub_ps(_mm256_add_ps(by1, by2), _mm256_add_ps(ay1, ay2));
+            const __m256 rho2 = _mm256_mul_ps(
+                _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                _mm256_set1_ps(0.25f));
+            iou = _mm256_sub_ps(iou, _mm256_div_ps(rho2, c2));
+        }
+        uint64_t mask = _mm256_movemask_ps(_mm256_cmp_ps(iou, th, _CMP_GT_OQ));
+        if (j <= i)
+            mask &= ~uint64_t(0) << (i + 1 - j);
+        suppressed[j / 64] |= mask << (j % 64);
+    }
+#endif
+    for (; j < boxes.size(); ++j)
+    {
+        if (j <= i)
+            continue;
+        const float iw = std::max(
+            0.0f,
+            std::min(boxes.x2[i], boxes.x2[j]) - std::max(boxes.x1[i], boxes.x1[j]));
+        const float ih = std::max(
+            0.0f,
+            std::min(boxes.y2[i], boxes.y2[j]) - std::max(boxes.y1[i], boxes.y1[j]));
+        const float inter = iw * ih;
+        float iou = inter / (boxes.area[i] + boxes.area[j] - inter);
+        if (diou)
+        {
+            const float cw = std::max(boxes.x2[i], boxes.x2[j]) - std::min(boxes.x1[i], boxes.x1[j]);
+            const float ch = std::max(boxes.y2[i], boxes.y2[j]) - std::min(boxes.y1[i], boxes.y1[j]);
+            const float dx = (boxes.x1[j] + boxes.x2[j]) - (boxes.x1[i] + boxes.x2[i]);
+            const float dy = (boxes.y1[j] + boxes.y2[j]) - (boxes.y1[i] + boxes.y2[i]);
+            iou -= 0.25f * (dx * dx + dy * dy) / (cw * cw + ch * ch + 1e-16f);
+        }
+        if (iou > thresh)
+            suppressed[j / 64] |= uint64_t(1) << (j % 64);
+    }
 }
 
-inline void nms(float conf_thresh, float nms_thresh, std::vector<detection>& detections)
+// Greedy non-maximum suppression.  The candidates are grouped by class id, sorted by score
+// and capped to options.top_k per class.  The overlaps are computed in batches on a
+// structure-of-arrays copy of each group, and suppressed boxes are tracked in a bitmask.  The
+// surviving detections are returned sorted by decreasing score.
+inline void nms(
+    float conf_thresh,
+    float nms_thresh,
+    std::vector<detection>& detections,
+    const nms_options& options = nms_options())
 {
     // conf thresh on score
     detections.erase(
@@ -229,36 +425,74 @@ inline void nms(float conf_thresh, float nms_thresh, std::vector<detection>& det
             [conf_thresh](const detection& d) { return d.score < conf_thresh; }),
         detections.end());
 
-    // sort conf
+    // group by class and sort by decreasing score within each group
+    thread_local std::vector<uint32_t> order;
+    order.resize(detections.size());
+    std::iota(order.begin(), order.end(), 0);
+    const bool agnostic = options.class_agnostic;
     std::sort(
-        detections.begin(),
-        detections.end(),
-        [](const detection& a, const detection& b) -> bool { return a.score > b.score; });
+        order.begin(),
+        order.end(),
+        [&detections, agnostic](const uint32_t a, const uint32_t b)
+        {
+            const auto& da = detections[a];
+            const auto& db = detections[b];
+            if (not agnostic and da.id != db.id)
+                return da.id < db.id;
+            return da.score > db.score;
+        });
 
-    // nms
-    for (size_t d = 0; d < detections.size(); d++)
+    thread_local std::vector<char> keep;
+    thread_local std::vector<uint64_t> suppressed;
+    thread_local nms_boxes boxes;
+    keep.assign(detections.size(), 0);
+    for (size_t begin = 0, end = 0; begin < order.size(); begin = end)
     {
-        if (detections[d].is_empty())
-            continue;
-
-        for (size_t dj = 0; dj < detections.size(); dj++)
+        end = begin + 1;
+        while (end < order.size() and
+               (agnostic or detections[order[end]].id == detections[order[begin]].id))
+            ++end;
+        const size_t n = options.top_k > 0 ? std::min(end - begin, options.top_k) : end - begin;
+        const uint32_t* const idx = &order[begin];
+        suppressed.assign((n + 63) / 64, 0);
+        const bool vectorized = options.iou_type == IOU or options.iou_type == DIOU;
+        if (vectorized)
+            boxes.assign(detections, idx, n);
+        for (size_t i = 0; i < n; ++i)
         {
-            if (d == dj || detections[dj].is_empty())
+            if (suppressed[i / 64] >> (i % 64) & 1)
                 continue;
+            keep[idx[i]] = 1;
+            if (vectorized)
+            {
+                suppress_overlaps(boxes, i, nms_thresh, options.iou_type, suppressed.data());
+                continue;
+            }
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                if (iou(detections[idx[i]], detections[idx[j]], options.iou_type) > nms_thresh)
+                    suppressed[j / 64] |= uint64_t(1) << (j % 64);
+            }
+        }
+    }
 
-            float _iou = iou(detections[d], detections[dj], IOU);
-
-            if (_iou > nms_thresh)
-                detections[dj].set_empty();
+    size_t num_kept = 0;
+    for (size_t i = 0; i < detections.size(); ++i)
+    {
+        if (keep[i])
+        {
+            if (i != num_kept)
+                detections[num_kept] = std::move(detections[i]);
+            ++num_kept;
         }
     }
+    detections.resize(num_kept);
 
-    detections.erase(
-        std::remove_if(
-            detections.begin(),
-            detections.end(),
-            [](const detection& d) { return d.is_empty(); }),
-        detections.end());
+    // sort conf
+    std::sort(
+        detections.begin(),
+        detections.end(),
+        [](const detection& a, const detection& b) -> bool { return a.score > b.score; });
 }
 
 #endif  // yolo_utils_h_INCLUDED
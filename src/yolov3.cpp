@@ -1,5 +1,11 @@
 #include "yolov3.h"
 
+#include "convert.h"
+#include "prune_model.h"
+
+template class yolo_detector<darknet::yolov3_infer>;
+template class yolo_detector<darknet::yolov3_fused>;
+
 yolov3::yolov3(const std::string& dnn_path, const std::string& labels_path)
 {
     load_weights(dnn_path);
@@ -8,3 +14,42 @@ yolov3::yolov3(const std::string& dnn_path, const std::string& labels_path)
     anchors16 = {{30, 61}, {62, 45}, {59, 119}};
     anchors32 = {{116, 90}, {156, 198}, {373, 326}};
 }
+
+yolov3_fused::yolov3_fused(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors8 = {{10, 13}, {16, 30}, {33, 23}};
+    anchors16 = {{30, 61}, {62, 45}, {59, 119}};
+    anchors32 = {{116, 90}, {156, 198}, {373, 326}};
+}
+
+std::unique_ptr<object_detector> load_yolov3(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    const bool fused)
+{
+    if (fused)
+        return std::make_unique<yolov3_fused>(dnn_path, labels_path);
+    return std::make_unique<yolov3>(dnn_path, labels_path);
+}
+
+void convert_yolov3(const conversion_options& options)
+{
+    convert<
+        darknet::yolov3_train,
+        darknet::yolov3_infer,
+        darknet::yolov3_fused,
+        1>(options);
+}
+
+std::unique_ptr<object_detector> prune_yolov3(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    return prune_model<
+        darknet::yolov3_train,
+        1,
+        darknet::yolov3_infer,
+        darknet::yolov3_fused>(detector, options);
+}
@@ -0,0 +1,54 @@
+#include "yolov3_tiny.h"
+
+#include "convert.h"
+#include "prune_model.h"
+
+template class yolo_detector<darknet::yolov3_tiny_infer>;
+template class yolo_detector<darknet::yolov3_tiny_fused>;
+
+// anchors 0, 1, 2 and 3, 4, 5 of 10,14, 23,27, 37,58, 81,82, 135,169, 344,319
+yolov3_tiny::yolov3_tiny(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors16 = {{10, 14}, {23, 27}, {37, 58}};
+    anchors32 = {{81, 82}, {135, 169}, {344, 319}};
+}
+
+yolov3_tiny_fused::yolov3_tiny_fused(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors16 = {{10, 14}, {23, 27}, {37, 58}};
+    anchors32 = {{81, 82}, {135, 169}, {344, 319}};
+}
+
+std::unique_ptr<object_detector> load_yolov3_tiny(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    const bool fused)
+{
+    if (fused)
+        return std::make_unique<yolov3_tiny_fused>(dnn_path, labels_path);
+    return std::make_unique<yolov3_tiny>(dnn_path, labels_path);
+}
+
+void convert_yolov3_tiny(const conversion_options& options)
+{
+    convert<
+        darknet::yolov3_tiny_train,
+        darknet::yolov3_tiny_infer,
+        darknet::yolov3_tiny_fused,
+        1>(options);
+}
+
+std::unique_ptr<object_detector> prune_yolov3_tiny(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    return prune_model<
+        darknet::yolov3_tiny_train,
+        1,
+        darknet::yolov3_tiny_infer,
+        darknet::yolov3_tiny_fused>(detector, options);
+}
@@ -0,0 +1,23 @@
+#ifndef yolov3_tiny_h_INCLUDED
+#define yolov3_tiny_h_INCLUDED
+
+#include "model_entries.h"
+#include "yolo.h"
+
+extern template class yolo_detector<darknet::yolov3_tiny_infer>;
+extern template class yolo_detector<darknet::yolov3_tiny_fused>;
+
+class yolov3_tiny : public yolo_detector<darknet::yolov3_tiny_infer>
+{
+    public:
+    yolov3_tiny(const std::string& dnn_path, const std::string& labels_path);
+};
+
+// the same model built with fused_con layers, converted with convert_weights --fused
+class yolov3_tiny_fused : public yolo_detector<darknet::yolov3_tiny_fused>
+{
+    public:
+    yolov3_tiny_fused(const std::string& dnn_path, const std::string& labels_path);
+};
+
+#endif // yolov3_tiny_h_INCLUDED
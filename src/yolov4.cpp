@@ -1,5 +1,11 @@
 #include "yolov4.h"
 
+#include "convert.h"
+#include "prune_model.h"
+
+template class yolo_detector<darknet::yolov4_infer>;
+template class yolo_detector<darknet::yolov4_fused>;
+
 yolov4::yolov4(const std::string& dnn_path, const std::string& labels_path)
 {
     load_weights(dnn_path);
@@ -8,3 +14,42 @@ yolov4::yolov4(const std::string& dnn_path, const std::string& labels_path)
     anchors16 = {{36, 75}, {76, 55}, {72, 146}};
     anchors32 = {{142, 110}, {192, 243}, {459, 401}};
 }
+
+yolov4_fused::yolov4_fused(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors8 = {{12, 16}, {19, 36}, {40, 28}};
+    anchors16 = {{36, 75}, {76, 55}, {72, 146}};
+    anchors32 = {{142, 110}, {192, 243}, {459, 401}};
+}
+
+std::unique_ptr<object_detector> load_yolov4(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    const bool fused)
+{
+    if (fused)
+        return std::make_unique<yolov4_fused>(dnn_path, labels_path);
+    return std::make_unique<yolov4>(dnn_path, labels_path);
+}
+
+void convert_yolov4(const conversion_options& options)
+{
+    convert<
+        darknet::yolov4_train,
+        darknet::yolov4_infer,
+        darknet::yolov4_fused,
+        1>(options);
+}
+
+std::unique_ptr<object_detector> prune_yolov4(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    return prune_model<
+        darknet::yolov4_train,
+        1,
+        darknet::yolov4_infer,
+        darknet::yolov4_fused>(detector, options);
+}
@@ -1,12 +1,23 @@
 #ifndef yolov4_h_INCLUDED
 #define yolov4_h_INCLUDED
 
+#include "model_entries.h"
 #include "yolo.h"
 
+extern template class yolo_detector<darknet::yolov4_infer>;
+extern template class yolo_detector<darknet::yolov4_fused>;
+
 class yolov4 : public yolo_detector<darknet::yolov4_infer>
 {
     public:
     yolov4(const std::string& dnn_path, const std::string& labels_path);
 };
 
+// the same model built with fused_con layers, converted with convert_weights --fused
+class yolov4_fused : public yolo_detector<darknet::yolov4_fused>
+{
+    public:
+    yolov4_fused(const std::string& dnn_path, const std::string& labels_path);
+};
+
 #endif // yolov4_h_INCLUDED
@@ -1,12 +1,23 @@
 #ifndef yolov4_sam_mish_h_INCLUDED
 #define yolov4_sam_mish_h_INCLUDED
 
+#include "model_entries.h"
 #include "yolo.h"
 
+extern template class yolo_detector<darknet::yolov4_sam_mish_infer>;
+extern template class yolo_detector<darknet::yolov4_sam_mish_fused>;
+
 class yolov4_sam_mish : public yolo_detector<darknet::yolov4_sam_mish_infer>
 {
     public:
     yolov4_sam_mish(const std::string& dnn_path, const std::string& labels_path);
 };
 
+// the same model built with fused_con layers, converted with convert_weights --fused
+class yolov4_sam_mish_fused : public yolo_detector<darknet::yolov4_sam_mish_fused>
+{
+    public:
+    yolov4_sam_mish_fused(const std::string& dnn_path, const std::string& labels_path);
+};
+
 #endif // yolov4_sam_mish_h_INCLUDED
@@ -0,0 +1,54 @@
+#include "yolov4_tiny.h"
+
+#include "convert.h"
+#include "prune_model.h"
+
+template class yolo_detector<darknet::yolov4_tiny_infer>;
+template class yolo_detector<darknet::yolov4_tiny_fused>;
+
+// anchors 1, 2, 3 and 3, 4, 5 of 10,14, 23,27, 37,58, 81,82, 135,169, 344,319
+yolov4_tiny::yolov4_tiny(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors16 = {{23, 27}, {37, 58}, {81, 82}};
+    anchors32 = {{81, 82}, {135, 169}, {344, 319}};
+}
+
+yolov4_tiny_fused::yolov4_tiny_fused(const std::string& dnn_path, const std::string& labels_path)
+{
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors16 = {{23, 27}, {37, 58}, {81, 82}};
+    anchors32 = {{81, 82}, {135, 169}, {344, 319}};
+}
+
+std::unique_ptr<object_detector> load_yolov4_tiny(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    const bool fused)
+{
+    if (fused)
+        return std::make_unique<yolov4_tiny_fused>(dnn_path, labels_path);
+    return std::make_unique<yolov4_tiny>(dnn_path, labels_path);
+}
+
+void convert_yolov4_tiny(const conversion_options& options)
+{
+    convert<
+        darknet::yolov4_tiny_train,
+        darknet::yolov4_tiny_infer,
+        darknet::yolov4_tiny_fused,
+        1>(options);
+}
+
+std::unique_ptr<object_detector> prune_yolov4_tiny(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    return prune_model<
+        darknet::yolov4_tiny_train,
+        1,
+        darknet::yolov4_tiny_infer,
+        darknet::yolov4_tiny_fused>(detector, options);
+}
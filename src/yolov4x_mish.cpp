@@ -1,5 +1,11 @@
 #include "yolov4x_mish.h"
 
+#include "convert.h"
+#include "prune_model.h"
+
+template class yolo_detector<darknet::yolov4x_mish_infer>;
+template class yolo_detector<darknet::yolov4x_mish_fused>;
+
 yolov4x_mish::yolov4x_mish(const std::string& dnn_path, const std::string& labels_path)
 {
     new_coords = true;
@@ -9,3 +15,43 @@ yolov4x_mish::yolov4x_mish(const std::string& dnn_path, const std::string& label
     anchors16 = {{36, 75}, {76, 55}, {72, 146}};
     anchors32 = {{142, 110}, {192, 243}, {459, 401}};
 }
+
+yolov4x_mish_fused::yolov4x_mish_fused(const std::string& dnn_path, const std::string& labels_path)
+{
+    new_coords = true;
+    load_weights(dnn_path);
+    load_labels(labels_path);
+    anchors8 = {{12, 16}, {19, 36}, {40, 28}};
+    anchors16 = {{36, 75}, {76, 55}, {72, 146}};
+    anchors32 = {{142, 110}, {192, 243}, {459, 401}};
+}
+
+std::unique_ptr<object_detector> load_yolov4x_mish(
+    const std::string& dnn_path,
+    const std::string& labels_path,
+    const bool fused)
+{
+    if (fused)
+        return std::make_unique<yolov4x_mish_fused>(dnn_path, labels_path);
+    return std::make_unique<yolov4x_mish>(dnn_path, labels_path);
+}
+
+void convert_yolov4x_mish(const conversion_options& options)
+{
+    convert<
+        darknet::yolov4x_mish_train,
+        darknet::yolov4x_mish_infer,
+        darknet::yolov4x_mish_fused,
+        2>(options);
+}
+
+std::unique_ptr<object_detector> prune_yolov4x_mish(
+    const object_detector& detector,
+    const model_pruning_options& options)
+{
+    return prune_model<
+        darknet::yolov4x_mish_train,
+        2,
+        darknet::yolov4x_mish_infer,
+        darknet::yolov4x_mish_fused>(detector, options);
+}